@@ -0,0 +1,156 @@
+// Per-op timings for the SIMD math layer against the plain scalar Vec3 code
+// it replaces. Run a Release build; numbers are ns per call over a warm array.
+#include <chrono>
+#include <iostream>
+#include <format>
+#include <cmath>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+import common;
+import camera;
+import scene;
+
+using namespace rm;
+
+namespace {
+
+constexpr int kCount = 1 << 16;
+constexpr int kRepeats = 50;
+
+template <typename Fn>
+void bench(const std::string& name, std::vector<float>& out, Fn fn) {
+    fn(); // warm up
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int r = 0; r < kRepeats; r++) {
+        fn();
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / (double(kCount) * kRepeats);
+
+    // Fold the outputs so the compiler cannot drop the work
+    float checksum = 0.0f;
+    for (float v : out) checksum += v;
+
+    std::cout << std::format("{:<28} {:7.2f} ns/op   (checksum {:.3f})\n", name, ns, checksum);
+}
+
+} // namespace
+
+int main() {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> dist(-4.0f, 4.0f);
+
+    std::vector<Vec3> points(kCount);
+    std::vector<Vec3A> pointsA(kCount);
+    for (int i = 0; i < kCount; i++) {
+        points[i] = Vec3(dist(rng), dist(rng), dist(rng));
+        pointsA[i] = toVec3A(points[i]);
+    }
+    std::vector<float> out(kCount);
+
+    const Vec3 center(0.5f, -0.25f, 1.0f);
+    const Vec3 size(1.0f, 2.0f, 0.5f);
+    const Vec3 half = size * 0.5f;
+    const Vec3 forward(0.0f, 0.0f, 1.0f), right(1.0f, 0.0f, 0.0f), up(0.0f, 1.0f, 0.0f);
+
+    std::cout << "normalize\n";
+    bench("Vec3::normalize", out, [&] {
+        for (int i = 0; i < kCount; i++) out[i] = points[i].normalize().x;
+    });
+    bench("Vec3::normalizeFast", out, [&] {
+        for (int i = 0; i < kCount; i++) out[i] = points[i].normalizeFast().x;
+    });
+    bench("Vec3A::normalizeFast", out, [&] {
+        for (int i = 0; i < kCount; i++) out[i] = pointsA[i].normalizeFast().x();
+    });
+
+    std::cout << "primary ray direction\n";
+    bench("add + normalize", out, [&] {
+        for (int i = 0; i < kCount; i++) {
+            const Vec3& p = points[i];
+            out[i] = (forward + right * p.x + up * p.y).normalize().z;
+        }
+    });
+    bench("madd + normalizeFast", out, [&] {
+        for (int i = 0; i < kCount; i++) {
+            const Vec3& p = points[i];
+            out[i] = madd(up, p.y, madd(right, p.x, forward)).normalizeFast().z;
+        }
+    });
+
+    std::cout << "light direction and distance\n";
+    bench("length + divide", out, [&] {
+        for (int i = 0; i < kCount; i++) {
+            float d = points[i].length();
+            out[i] = (points[i] / d).y + d;
+        }
+    });
+    bench("fastRsqrt", out, [&] {
+        for (int i = 0; i < kCount; i++) {
+            float distSq = points[i].dot(points[i]);
+            float inv = fastRsqrt(distSq);
+            out[i] = (points[i] * inv).y + distSq * inv;
+        }
+    });
+
+    std::cout << "dot\n";
+    bench("Vec3::dot", out, [&] {
+        for (int i = 0; i < kCount; i++) out[i] = points[i].dot(center);
+    });
+    Vec3A centerA = toVec3A(center);
+    bench("Vec3A::dot", out, [&] {
+        for (int i = 0; i < kCount; i++) out[i] = pointsA[i].dot(centerA);
+    });
+
+    std::cout << "primitive distance\n";
+    bench("box (scalar)", out, [&] {
+        for (int i = 0; i < kCount; i++) {
+            const Vec3& p = points[i];
+            Vec3 q(std::abs(p.x - center.x) - half.x, std::abs(p.y - center.y) - half.y, std::abs(p.z - center.z) - half.z);
+            out[i] = std::min(std::max(q.x, std::max(q.y, q.z)), 0.0f) +
+                     Vec3(std::max(q.x, 0.0f), std::max(q.y, 0.0f), std::max(q.z, 0.0f)).length();
+        }
+    });
+    Box box(center, size);
+    bench("Box::distance (Vec3A)", out, [&] {
+        for (int i = 0; i < kCount; i++) out[i] = box.distance(points[i]);
+    });
+    bench("torus (Vec3 temporaries)", out, [&] {
+        for (int i = 0; i < kCount; i++) {
+            Vec3 p = points[i] - center;
+            Vec3 q(Vec3(p.x, 0.0f, p.z).length() - 1.0f, p.y, 0.0f);
+            out[i] = q.length() - 0.25f;
+        }
+    });
+    Torus torus(center, 1.0f, 0.25f);
+    bench("Torus::distance", out, [&] {
+        for (int i = 0; i < kCount; i++) out[i] = torus.distance(points[i]);
+    });
+    bench("sphere (scalar)", out, [&] {
+        for (int i = 0; i < kCount; i++) out[i] = (points[i] - center).length() - 0.5f;
+    });
+    bench("sphere (Vec3A)", out, [&] {
+        for (int i = 0; i < kCount; i++) out[i] = (pointsA[i] - centerA).length() - 0.5f;
+    });
+
+    std::cout << "primary rays (per ray, 256x256 image)\n";
+    Camera camera(45.0f, 1.0f);
+    camera.setPosition(Vec3(0.0f, 2.0f, 10.0f));
+    camera.prepareRays(256, 256, 1);
+    std::vector<Ray> rays;
+    bench("Camera::getRay", out, [&] {
+        for (int i = 0; i < kCount; i++) {
+            out[i] = camera.getRay((i % 256) / 256.0f, (i / 256) / 256.0f).direction.x;
+        }
+    });
+    bench("Camera::getRays (table)", out, [&] {
+        camera.getRays(PixelRect{0, 0, 256, 256}, rays);
+        for (int i = 0; i < kCount; i++) out[i] = rays[i].direction.x;
+    });
+
+    return 0;
+}
@@ -0,0 +1,204 @@
+// Per-kernel timings for SDF primitives, CSG nodes and the march loop, so a
+// regression in a hot kernel shows up before it reaches a whole-frame number.
+// Run a Release build. Pass --csv for machine-readable output:
+//   kernel,objects,unit,ns_per_unit,units_per_sec
+#include <chrono>
+#include <iostream>
+#include <format>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+import common;
+import scene;
+
+using namespace rm;
+
+namespace {
+
+constexpr int kPoints = 1 << 14;
+constexpr double kMinSeconds = 0.2;
+
+bool csv = false;
+volatile float sink = 0.0f;
+
+// Repeat fn, which does `units` evaluations per call, until kMinSeconds has
+// passed; reports ns per evaluation
+template <typename Fn>
+void bench(const std::string& kernel, size_t objects, const char* unit, int units, Fn fn) {
+    sink = sink + fn(); // warm up
+
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    double elapsed = 0.0;
+    long long calls = 0;
+    float checksum = 0.0f;
+    while (elapsed < kMinSeconds) {
+        checksum += fn();
+        calls++;
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+    sink = sink + checksum;
+
+    double ns = elapsed * 1e9 / (double(calls) * units);
+    if (csv) {
+        std::cout << std::format("{},{},{},{:.3f},{:.0f}\n", kernel, objects, unit, ns, 1e9 / ns);
+    } else {
+        std::cout << std::format("{:<32} {:>6} {:>10.2f} ns/{:<5} {:>14.0f} {}/s\n",
+                                 kernel, objects, ns, unit, 1e9 / ns, unit);
+    }
+}
+
+// Distance evaluations of one SDF over a fixed set of points
+void benchDistance(const std::string& kernel, const SDF& sdf, const std::vector<Vec3>& points) {
+    bench(kernel, 1, "eval", kPoints, [&] {
+        float sum = 0.0f;
+        for (const Vec3& p : points) sum += sdf.distance(p);
+        return sum;
+    });
+}
+
+// Box-filled scenes are sphere traced (boxes have no closed-form path);
+// sphere-filled ones go through the analytic intersection path
+std::shared_ptr<SDF> randomObject(std::mt19937& rng, bool boxes) {
+    std::uniform_real_distribution<float> pos(-20.0f, 20.0f);
+    std::uniform_real_distribution<float> size(0.1f, 0.4f);
+    Vec3 center(pos(rng), pos(rng), pos(rng));
+    if (boxes) {
+        float s = size(rng);
+        return std::make_shared<Box>(center, Vec3(s, s, s) * 2.0f);
+    }
+    return std::make_shared<Sphere>(center, size(rng));
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t maxObjects = 10000;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--csv") == 0) {
+            csv = true;
+        } else if (std::strcmp(argv[i], "--max-objects") == 0 && i + 1 < argc) {
+            maxObjects = std::stoul(argv[++i]);
+        } else {
+            std::cerr << "usage: raymarch_microbench [--csv] [--max-objects N]\n";
+            return 1;
+        }
+    }
+    if (csv) {
+        std::cout << "kernel,objects,unit,ns_per_unit,units_per_sec\n";
+    }
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> dist(-4.0f, 4.0f);
+    std::vector<Vec3> points(kPoints);
+    for (Vec3& p : points) {
+        p = Vec3(dist(rng), dist(rng), dist(rng));
+    }
+
+    // Primitives
+    auto sphere = std::make_shared<Sphere>(Vec3(0.5f, -0.25f, 1.0f), 1.0f);
+    auto box = std::make_shared<Box>(Vec3(-0.5f, 0.25f, 0.0f), Vec3(1.0f, 2.0f, 0.5f));
+    auto torus = std::make_shared<Torus>(Vec3(0.0f, 0.0f, 0.0f), 1.0f, 0.25f);
+    auto cylinder = std::make_shared<Cylinder>(Vec3(0.0f, 0.0f, 0.0f), 0.5f, 2.0f);
+    auto plane = std::make_shared<Plane>(Vec3(0.0f, 1.0f, 0.0f), 1.0f);
+    benchDistance("Sphere::distance", *sphere, points);
+    benchDistance("Box::distance", *box, points);
+    benchDistance("Torus::distance", *torus, points);
+    benchDistance("Cylinder::distance", *cylinder, points);
+    benchDistance("Plane::distance", *plane, points);
+
+    // Central-difference gradient: 6 distance evaluations each
+    bench("SDF::normal (sphere)", 1, "eval", kPoints, [&] {
+        float sum = 0.0f;
+        for (const Vec3& p : points) sum += sphere->normal(p).x;
+        return sum;
+    });
+    bench("SDF::normal (box)", 1, "eval", kPoints, [&] {
+        float sum = 0.0f;
+        for (const Vec3& p : points) sum += box->normal(p).x;
+        return sum;
+    });
+
+    // CSG nodes over the primitives above
+    benchDistance("Union", Union(sphere, box), points);
+    benchDistance("SmoothUnion", SmoothUnion(sphere, box, 0.5f), points);
+    benchDistance("Subtraction", Subtraction(box, sphere), points);
+    benchDistance("Intersection", Intersection(box, sphere), points);
+    benchDistance("Displacement", Displacement(sphere, 0.1f, 8.0f), points);
+    
+    // Level of detail near (detail only), in the blend band and far (proxy only)
+    auto detail = std::make_shared<SmoothUnion>(std::make_shared<Intersection>(box, sphere), torus, 0.3f);
+    LodSDF lod(detail, std::make_shared<Sphere>(detail->bounds().center(), 2.0f), 0.2f);
+    const float pixelAngle = 0.001f;
+    for (float viewDistance : {10.0f, 75.0f, 1000.0f}) {
+        lod.setViewer(Vec3(0.0f, 0.0f, viewDistance), pixelAngle);
+        benchDistance(std::format("LodSDF (proxy weight {:.2f})", lod.getProxyWeight()), lod, points);
+    }
+
+    // Domain repetition and transforms
+    auto small = std::make_shared<Sphere>(Vec3(0.0f, 0.0f, 0.0f), 0.3f);
+    RepetitionSDF repeat(small, Vec3(1.0f, 1.0f, 1.0f));
+    benchDistance("RepetitionSDF", repeat, points);
+    RepetitionSDF repeatNeighbors(small, Vec3(1.0f, 1.0f, 1.0f));
+    repeatNeighbors.setNeighborCheck(true);
+    benchDistance("RepetitionSDF (neighbors)", repeatNeighbors, points);
+    Transform placement = Transform::translate(Vec3(1.0f, 0.0f, 0.0f)) * Transform::rotate(Vec3(1.0f, 1.0f, 0.0f), 30.0f);
+    benchDistance("TransformSDF", TransformSDF(torus, placement), points);
+
+    // Rays from the origin toward random points on a sphere of directions
+    constexpr int kRays = 256;
+    std::normal_distribution<float> gauss;
+    std::vector<Ray> rays;
+    for (int i = 0; i < kRays; i++) {
+        rays.emplace_back(Vec3(0.0f, 0.0f, 0.0f), Vec3(gauss(rng), gauss(rng), gauss(rng)).normalize());
+    }
+
+    // Scaling with object count
+    for (size_t count = 1; count <= maxObjects; count *= 10) {
+        std::mt19937 sceneRng(42);
+        Scene boxes;
+        Scene spheres;
+        std::vector<Transform> instances;
+        std::uniform_real_distribution<float> pos(-20.0f, 20.0f);
+        for (size_t i = 0; i < count; i++) {
+            boxes.add(randomObject(sceneRng, true));
+            spheres.add(randomObject(sceneRng, false));
+            instances.push_back(Transform::translate(Vec3(pos(sceneRng), pos(sceneRng), pos(sceneRng))));
+        }
+
+        bench("Scene::distance (boxes)", count, "eval", kPoints / 16, [&] {
+            float sum = 0.0f;
+            for (int i = 0; i < kPoints / 16; i++) sum += boxes.distance(points[i]);
+            return sum;
+        });
+        bench("InstanceSDF::distance", count, "eval", kPoints / 16, [&, sdf = InstanceSDF(box, instances)] {
+            float sum = 0.0f;
+            for (int i = 0; i < kPoints / 16; i++) sum += sdf.distance(points[i]);
+            return sum;
+        });
+        bench("Scene::march (boxes)", count, "ray", kRays, [&] {
+            float sum = 0.0f;
+            Hit hit;
+            for (const Ray& ray : rays) sum += boxes.march(ray, hit) ? hit.distance : 0.0f;
+            return sum;
+        });
+        bench("Scene::march (spheres)", count, "ray", kRays, [&] {
+            float sum = 0.0f;
+            Hit hit;
+            for (const Ray& ray : rays) sum += spheres.march(ray, hit) ? hit.distance : 0.0f;
+            return sum;
+        });
+        bench("Scene::occluded (boxes)", count, "ray", kRays, [&] {
+            float sum = 0.0f;
+            for (const Ray& ray : rays) sum += boxes.occluded(ray, 10.0f) ? 1.0f : 0.0f;
+            return sum;
+        });
+    }
+
+    return 0;
+}
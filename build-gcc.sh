@@ -39,7 +39,10 @@ compile_module() {
 compile_module "common"
 compile_module "camera" "common"
 compile_module "scene" "common"
-compile_module "renderer" "common camera scene"
+compile_module "framering"
+compile_module "renderer" "common camera scene framering"
+compile_module "autotune" "common camera scene framering renderer"
+compile_module "sequence"
 
 # Compile main program
 echo "Compiling main program"
@@ -47,11 +50,14 @@ g++ -std=c++23 -fmodules-ts \
     -fmodule-file=gcm.cache/common.gcm \
     -fmodule-file=gcm.cache/camera.gcm \
     -fmodule-file=gcm.cache/scene.gcm \
+    -fmodule-file=gcm.cache/framering.gcm \
     -fmodule-file=gcm.cache/renderer.gcm \
+    -fmodule-file=gcm.cache/autotune.gcm \
+    -fmodule-file=gcm.cache/sequence.gcm \
     -c -o main.o ../src/main.cpp
 
 # Link everything
 echo "Linking..."
-g++ -o raymarch main.o common.o camera.o scene.o renderer.o -lsfml-graphics -lsfml-window -lsfml-system
+g++ -o raymarch main.o common.o camera.o scene.o framering.o renderer.o autotune.o sequence.o -lsfml-graphics -lsfml-window -lsfml-system
 
 echo "Build complete. Run with: ./raymarch"
\ No newline at end of file
@@ -5,12 +5,23 @@
 #include <format>
 #include <cmath>
 #include <array>
+#include <charconv>
+#include <cstring>
+#include <optional>
+#include <vector>
+#include <stdexcept>
 #include <string>
+#ifdef __linux__
+#include <unistd.h>
+#endif
 
 import common;
 import camera;
 import scene;
+import framering;
 import renderer;
+import autotune;
+import sequence;
 
 // Helper function to draw text
 void drawText(sf::RenderWindow& window, const std::string& text, const sf::Vector2f& position,
@@ -24,30 +35,82 @@ void drawText(sf::RenderWindow& window, const std::string& text, const sf::Vecto
     window.draw(textObject);
 }
 
-int main() {
-    // Window setup
-    const int width = 1280;
-    const int height = 720;
-    sf::RenderWindow window(sf::VideoMode(width, height), "C++23 Ray Marching");
-    window.setFramerateLimit(60);
+// Auto camera path: a wide orbit with a slowly wandering look-at point
+void orbitCamera(float time, rm::Vec3& position, rm::Vec3& target) {
+    float radius = 15.0f; // Wider orbit
+    float camX = radius * std::sin(time * 0.2f);
+    float camZ = radius * std::cos(time * 0.2f);
+    float camY = 3.5f + std::sin(time * 0.3f) * 2.0f; // More dramatic height changes
+    position = rm::Vec3(camX, camY, camZ);
+
+    // Look at a point that moves slightly
+    float targetX = std::sin(time * 0.15f) * 3.0f;
+    float targetZ = std::cos(time * 0.15f) * 3.0f;
+    target = rm::Vec3(targetX, 0.5f + std::sin(time * 0.4f) * 0.5f, targetZ);
+}
 
-    // Setup camera
-    rm::Camera camera(45.0f, static_cast<float>(width) / height);
-    camera.setPosition(rm::Vec3(0.0f, 2.0f, 10.0f));
-    camera.setTarget(rm::Vec3(0.0f, 0.0f, 0.0f));
+bool parseFrameFormat(const char* name, rm::FrameFormat& format) {
+    const std::pair<const char*, rm::FrameFormat> formats[] = {
+        {"ppm", rm::FrameFormat::Ppm}, {"png", rm::FrameFormat::Png},
+        {"y4m", rm::FrameFormat::Y4m}, {"raw", rm::FrameFormat::Raw}};
+    for (const auto& [key, value] : formats) {
+        if (std::strcmp(name, key) == 0) {
+            format = value;
+            return true;
+        }
+    }
+    return false;
+}
 
-    // Create a scene
+// Whole-argument positive integer; anything else is a usage error
+bool parsePositive(const char* text, int& value) {
+    const char* end = text + std::strlen(text);
+    int parsed = 0;
+    auto [ptr, error] = std::from_chars(text, end, parsed);
+    if (error != std::errc() || ptr != end || parsed <= 0) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+// Memory the slots of a pipelined sequence may use together: half of
+// physical memory, or 0 (no limit) where that is unknown
+size_t sequenceMemoryBudget() {
+#ifdef __linux__
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pageSize > 0) {
+        return size_t(pages) * size_t(pageSize) / 2;
+    }
+#endif
+    return 0;
+}
+
+// The demo scene, with handles to the parts that animate
+struct DemoScene {
     rm::Scene scene;
+    std::shared_ptr<rm::LodSDF> centralLod;
+    rm::ObjectId centralLodId = 0;
+    rm::ObjectId torus1Id = 0;
+    rm::ObjectId torus2Id = 0;
+};
+
+void buildScene(DemoScene& demo) {
+    rm::Scene& scene = demo.scene;
 
     // Add a ground plane
     auto ground = std::make_shared<rm::Plane>(rm::Vec3(0.0f, 1.0f, 0.0f), 1.0f);
-    ground->setMaterial(rm::Material(rm::Vec3(0.4f, 0.4f, 0.4f), 0.1f, 0.9f));
+    ground->setMaterial(scene.addMaterial(rm::Material(rm::Vec3(0.4f, 0.4f, 0.4f), 0.1f, 0.9f)));
     scene.add(ground);
 
-    // Create a row of pillars
+    // Create a row of pillars, sharing their materials
+    rm::MaterialId pillarMaterial = scene.addMaterial(rm::Material(rm::Vec3(0.7f, 0.7f, 0.7f), 0.2f, 0.5f));
+    rm::MaterialId redGlow = scene.addMaterial(rm::Material(rm::Vec3(0.9f, 0.2f, 0.2f), 0.9f, 0.05f, 0.1f));
+    rm::MaterialId blueGlow = scene.addMaterial(rm::Material(rm::Vec3(0.2f, 0.2f, 0.9f), 0.9f, 0.05f, 0.1f));
     for (int i = -4; i <= 4; i += 2) {
         auto pillar = std::make_shared<rm::Cylinder>(rm::Vec3(i, 0.0f, -5.0f), 0.5f, 3.0f);
-        pillar->setMaterial(rm::Material(rm::Vec3(0.7f, 0.7f, 0.7f), 0.2f, 0.5f));
+        pillar->setMaterial(pillarMaterial);
         scene.add(pillar);
 
         // Add a sphere on top of each pillar
@@ -55,9 +118,9 @@ int main() {
 
         // Alternate colors - more vibrant with emissive properties
         if (i % 4 == 0) {
-            sphere->setMaterial(rm::Material(rm::Vec3(0.9f, 0.2f, 0.2f), 0.9f, 0.05f, 0.1f));
+            sphere->setMaterial(redGlow);
         } else {
-            sphere->setMaterial(rm::Material(rm::Vec3(0.2f, 0.2f, 0.9f), 0.9f, 0.05f, 0.1f));
+            sphere->setMaterial(blueGlow);
         }
 
         scene.add(sphere);
@@ -65,22 +128,25 @@ int main() {
 
     // Create some tori
     auto torus1 = std::make_shared<rm::Torus>(rm::Vec3(-3.0f, 0.5f, 0.0f), 1.0f, 0.25f);
-    torus1->setMaterial(rm::Material(rm::Vec3(0.9f, 0.5f, 0.2f), 0.7f, 0.1f));
-    scene.add(torus1);
+    torus1->setMaterial(scene.addMaterial(rm::Material(rm::Vec3(0.9f, 0.5f, 0.2f), 0.7f, 0.1f)));
+    demo.torus1Id = scene.add(torus1);
 
     auto torus2 = std::make_shared<rm::Torus>(rm::Vec3(3.0f, 0.5f, 0.0f), 1.0f, 0.25f);
-    torus2->setMaterial(rm::Material(rm::Vec3(0.2f, 0.9f, 0.5f), 0.7f, 0.1f));
-    scene.add(torus2);
+    torus2->setMaterial(scene.addMaterial(rm::Material(rm::Vec3(0.2f, 0.9f, 0.5f), 0.7f, 0.1f)));
+    demo.torus2Id = scene.add(torus2);
 
     // Create a central structure
     auto centralBox = std::make_shared<rm::Box>(rm::Vec3(0.0f, 1.0f, 0.0f), rm::Vec3(2.0f, 2.0f, 2.0f));
-    centralBox->setMaterial(rm::Material(rm::Vec3(0.3f, 0.3f, 0.3f), 0.8f, 0.05f));
+    centralBox->setMaterial(scene.addMaterial(rm::Material(rm::Vec3(0.3f, 0.3f, 0.3f), 0.8f, 0.05f)));
 
     auto centralSphere = std::make_shared<rm::Sphere>(rm::Vec3(0.0f, 1.0f, 0.0f), 1.4f);
-    centralSphere->setMaterial(rm::Material(rm::Vec3(0.95f, 0.9f, 0.1f), 0.9f, 0.05f, 0.15f));
+    centralSphere->setMaterial(scene.addMaterial(rm::Material(rm::Vec3(0.95f, 0.9f, 0.1f), 0.9f, 0.05f, 0.15f)));
 
+    // Far away, the rounded corners it trims off the box are under two
+    // pixels, so the plain box stands in for the intersection
     auto centralCSG = std::make_shared<rm::Intersection>(centralBox, centralSphere);
-    scene.add(centralCSG);
+    demo.centralLod = std::make_shared<rm::LodSDF>(centralCSG, centralBox, 0.3f);
+    demo.centralLodId = scene.add(demo.centralLod);
 
     // Add dramatic light setup for darker atmosphere
     scene.setAmbientLight(rm::Vec3(0.02f, 0.02f, 0.04f)); // Very dim bluish ambient
@@ -93,11 +159,20 @@ int main() {
 
     // Dramatic red highlight
     scene.addLight(rm::Vec3(0.0f, 3.0f, -15.0f), rm::Vec3(0.9f, 0.2f, 0.2f), 0.8f);
+}
 
-    // Create renderer
-    rm::Renderer renderer(width, height);
+// Blend the central LOD for the camera; a new blend reshapes the object in
+// place, which listening renderers must re-render and drop cached occlusion for
+void updateLod(DemoScene& demo, const rm::Camera& camera, int height) {
+    if (demo.centralLod->setViewer(camera.getPosition(), camera.getPixelAngle(height))) {
+        demo.scene.markChanged(demo.centralLodId);
+    }
+}
+
+void configureRenderer(rm::Renderer& renderer) {
     renderer.setExposure(1.8f); // Increased exposure to balance the darker scene
     renderer.setSamplesPerPixel(1);  // Low for interactive performance
+    renderer.setDenoise(true);       // Edge AA and noise filtering make up for it
     renderer.setMaxBounces(2);  // Reduce bounces for better performance
 
     // Set darker sky and ground colors
@@ -110,11 +185,211 @@ int main() {
         rm::Vec3(0.2f, 0.2f, 0.15f), // Horizon (dark ground)
         rm::Vec3(0.05f, 0.05f, 0.02f)  // Nadir (nearly black)
     );
+}
+
+int main(int argc, char** argv) {
+    // Headless sequence options
+    int sequenceFrames = 0;
+    rm::FrameFormat sequenceFormat = rm::FrameFormat::Ppm;
+    std::string sequenceOutput;
+    int sequenceFps = 30;
+    int framesInFlight = 2;
+    std::string shareFrames;
+    bool autoTune = false;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--sequence") == 0 && i + 1 < argc && parsePositive(argv[i + 1], sequenceFrames)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--format") == 0 && i + 1 < argc && parseFrameFormat(argv[i + 1], sequenceFormat)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            sequenceOutput = argv[++i];
+        } else if (std::strcmp(argv[i], "--fps") == 0 && i + 1 < argc && parsePositive(argv[i + 1], sequenceFps)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc && parsePositive(argv[i + 1], framesInFlight)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--autotune") == 0) {
+            autoTune = true;
+        } else if (std::strcmp(argv[i], "--share-frames") == 0 && i + 1 < argc) {
+            shareFrames = argv[++i];
+        } else {
+            std::cerr << "usage: raymarch [--sequence N [--format ppm|png|y4m|raw] [--output pattern] [--fps F] [--frames-in-flight K]] [--share-frames NAME] [--autotune]\n";
+            return 1;
+        }
+    }
+
+    // Window setup
+    const int width = 1280;
+    const int height = 720;
+
+    // Setup camera
+    rm::Camera camera(45.0f, static_cast<float>(width) / height);
+    camera.setPosition(rm::Vec3(0.0f, 2.0f, 10.0f));
+    camera.setTarget(rm::Vec3(0.0f, 0.0f, 0.0f));
+
+    // Create a scene
+    DemoScene demo;
+    buildScene(demo);
+    rm::Scene& scene = demo.scene;
+    const rm::ObjectId torus1Id = demo.torus1Id;
+    const rm::ObjectId torus2Id = demo.torus2Id;
+
+    // Create renderer
+    rm::Renderer renderer(width, height);
+    configureRenderer(renderer);
+
+    // Let the renderer re-render only the tiles touched by moving or
+    // reshaped objects
+    scene.addChangeListener([&renderer](const rm::ObjectChange& change) {
+        renderer.invalidate(change);
+    });
+
+    // Opt-in calibration of thread count, tile size and march step budget,
+    // cached per machine and scene in raymarch_tune.txt
+    std::optional<rm::TuneConfig> tuning;
+    if (autoTune) {
+        updateLod(demo, camera, height);
+        rm::AutoTuner tuner;
+        const rm::TuneResult result = tuner.tune(scene, camera, configureRenderer);
+        rm::AutoTuner::apply(result.config, renderer, scene);
+        tuning = result.config;
+        if (result.cached) {
+            std::cerr << "Auto-tune: using cached settings";
+        } else {
+            std::cerr << std::format("Auto-tune: {} settings tried, best {:.2f}ms per calibration frame ({:.1f} dB)",
+                                     result.configsTried, result.frameMs, result.psnr);
+        }
+        std::cerr << std::format(" - {} threads, {}px tiles, {} march steps\n",
+                                 result.config.threads, result.config.tileSize, result.config.marchSteps);
+    }
+
+    // Let local tools follow the frames through shared memory. A sequence
+    // publishes from the pipeline so readers see its frames in order; the
+    // window publishes straight from the renderer's tone pass.
+    std::unique_ptr<rm::SharedFrameRing> sequenceRing;
+    if (!shareFrames.empty()) {
+        if (shareFrames[0] != '/') {
+            shareFrames = "/" + shareFrames;
+        }
+        try {
+            if (sequenceFrames > 0) {
+                sequenceRing = std::make_unique<rm::SharedFrameRing>(shareFrames, width, height);
+            } else {
+                renderer.setFrameExport(shareFrames);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Frame export disabled: " << e.what() << "\n";
+        }
+        if (sequenceRing || renderer.isExportingFrames()) {
+            std::cerr << "Publishing frames to shared memory " << shareFrames << "\n";
+        }
+    }
+
+    // Headless: render the auto camera orbit and stream it to disk or stdout.
+    // Frames are handed to a writer thread so encoding overlaps the next
+    // render, and several frames are rendered at once, each slot with its
+    // own copy of the scene, camera and renderer.
+    if (sequenceFrames > 0) {
+        if (sequenceOutput.empty()) {
+            sequenceOutput = sequenceFormat == rm::FrameFormat::Png ? "frame_{:05}.png" : "frame_{:05}.ppm";
+        }
+
+        // Every slot holds its own full-size pixel buffers (only the camera
+        // ray table is shared), so K is capped by the memory budget
+        const size_t slotBytes = renderer.getFrameBytes(scene);
+        const size_t budget = sequenceMemoryBudget();
+        if (budget > 0 && size_t(framesInFlight) * slotBytes > budget) {
+            const int fit = static_cast<int>(std::max<size_t>(1, budget / slotBytes));
+            std::cerr << std::format("{} frames in flight need {:.0f} MB, more than the {:.0f} MB budget; using {}\n",
+                                     framesInFlight, framesInFlight * slotBytes / 1048576.0, budget / 1048576.0, fit);
+            framesInFlight = fit;
+        }
+        std::cerr << std::format("Sequence: {} frames in flight, {:.1f} MB of pixel buffers per slot\n",
+                                 framesInFlight, slotBytes / 1048576.0);
+
+        // Slot 0 is the main scene and renderer; the others get their own.
+        // The slots split the thread budget (every core, or the tuned count)
+        // rather than each spawning a full set of workers.
+        const int slotThreads = std::max(1, renderer.getThreadCount() / framesInFlight);
+        renderer.setThreadCount(slotThreads);
+        struct Slot {
+            DemoScene* demo;
+            rm::Renderer* renderer;
+            rm::Camera camera;
+        };
+        std::vector<std::unique_ptr<DemoScene>> extraScenes;
+        std::vector<std::unique_ptr<rm::Renderer>> extraRenderers;
+        std::vector<Slot> slots{{&demo, &renderer, camera}};
+        for (int i = 1; i < framesInFlight; i++) {
+            extraScenes.push_back(std::make_unique<DemoScene>());
+            buildScene(*extraScenes.back());
+            extraRenderers.push_back(std::make_unique<rm::Renderer>(width, height));
+            rm::Renderer* slotRenderer = extraRenderers.back().get();
+            configureRenderer(*slotRenderer);
+            extraScenes.back()->scene.addChangeListener([slotRenderer](const rm::ObjectChange& change) {
+                slotRenderer->invalidate(change);
+            });
+            if (tuning) {
+                rm::AutoTuner::apply(*tuning, *slotRenderer, extraScenes.back()->scene);
+            }
+            slotRenderer->setThreadCount(slotThreads);
+            slots.push_back({extraScenes.back().get(), slotRenderer, camera});
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        try {
+            rm::FrameWriter writer(sequenceFormat, width, height, sequenceOutput, sequenceFps,
+                                   framesInFlight + 2);
+            rm::FramePipeline pipeline(writer, framesInFlight);
+            if (sequenceRing) {
+                pipeline.setPublisher([&](const uint8_t* rgba) {
+                    std::memcpy(sequenceRing->beginWrite(), rgba, size_t(width) * height * 4);
+                    sequenceRing->endWrite(renderer.getExposure());
+                });
+            }
+            const rm::PipelineStats pipelineStats = pipeline.run(sequenceFrames, [&](int index, int frame) {
+                Slot& slot = slots[index];
+
+                // Same camera speed as the interactive auto camera at 60 fps
+                rm::Vec3 position, target;
+                orbitCamera(frame * 0.6f / sequenceFps, position, target);
+                slot.camera.setPosition(position);
+                slot.camera.setTarget(target);
+                updateLod(*slot.demo, slot.camera, height);
+
+                slot.renderer->render(slot.demo->scene, slot.camera);
+                return slot.renderer->getPixels();
+            });
+            writer.finish();
+
+            // stdout may be carrying the video, so report on stderr
+            std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+            const rm::WriterStats stats = writer.getStats();
+            std::cerr << std::format("Wrote {} frames in {:.2f}s ({:.2f} fps)\n",
+                                     stats.framesWritten, elapsed.count(), stats.framesWritten / elapsed.count());
+            std::cerr << std::format("  Pipeline: {} slots, {:.2f} frames rendering at once on average, {:.2f}s waiting on frame order\n",
+                                     pipelineStats.framesInFlight, pipelineStats.overlap(), pipelineStats.orderSeconds);
+            std::cerr << std::format("  Writer: {:.2f}s encoding, {} stalls ({:.2f}s blocked), max queue {}\n",
+                                     stats.writeSeconds, stats.stalls, stats.stallSeconds, stats.maxQueued);
+        } catch (const std::exception& e) {
+            std::cerr << "Sequence failed: " << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    sf::RenderWindow window(sf::VideoMode(width, height), "C++23 Ray Marching");
+    window.setFramerateLimit(60);
 
     // Camera control variables
     bool autoCamera = true;
     float time = 0.0f;
     bool needsRender = true;
+    bool needsRelight = false;
+    int keyLightLevel = 0;
+    rm::ToneMapper toneMapper = rm::ToneMapper::Clamp;
+    bool animateObjects = false;
+    bool ambientOcclusion = false;
+    float objectTime = 0.0f;
 
     // Manual camera control
     float cameraSpeed = 0.2f;
@@ -144,6 +419,12 @@ int main() {
     std::cout << "  Space - Toggle auto camera" << std::endl;
     std::cout << "  R - Increase samples per pixel" << std::endl;
     std::cout << "  F - Decrease samples per pixel" << std::endl;
+    std::cout << "  T - Cycle tone mapper" << std::endl;
+    std::cout << "  M - Toggle object animation" << std::endl;
+    std::cout << "  O - Toggle ambient occlusion" << std::endl;
+    std::cout << "  G - Toggle deferred shading" << std::endl;
+    std::cout << "  L - Cycle key light intensity (relights without re-marching when deferred)" << std::endl;
+    std::cout << "  N - Toggle denoiser" << std::endl;
     std::cout << "  Esc - Exit" << std::endl;
 
     // Main loop
@@ -175,6 +456,42 @@ int main() {
                     needsRender = true;
                     std::cout << std::format("Samples per pixel: {}\n", samples);
                 }
+                else if (event.key.code == sf::Keyboard::O) {
+                    ambientOcclusion = !ambientOcclusion;
+                    renderer.setAmbientOcclusion(ambientOcclusion);
+                    needsRender = true;
+                    std::cout << "Toggled ambient occlusion: " << (ambientOcclusion ? "ON" : "OFF") << "\n";
+                }
+                else if (event.key.code == sf::Keyboard::G) {
+                    renderer.setDeferred(!renderer.isDeferred());
+                    needsRender = true;
+                    std::cout << "Toggled deferred shading: " << (renderer.isDeferred() ? "ON" : "OFF") << "\n";
+                }
+                else if (event.key.code == sf::Keyboard::N) {
+                    renderer.setDenoise(!renderer.isDenoising());
+                    needsRender = true;
+                    std::cout << "Toggled denoiser: " << (renderer.isDenoising() ? "ON" : "OFF") << "\n";
+                }
+                else if (event.key.code == sf::Keyboard::L) {
+                    // Only shading changes, so the cached hits and shadows can be reused
+                    const float levels[] = {1.8f, 3.6f, 0.9f};
+                    keyLightLevel = (keyLightLevel + 1) % 3;
+                    scene.setLightIntensity(0, levels[keyLightLevel]);
+                    needsRelight = true;
+                    std::cout << std::format("Key light intensity: {:.1f}\n", levels[keyLightLevel]);
+                }
+                else if (event.key.code == sf::Keyboard::M) {
+                    animateObjects = !animateObjects;
+                    std::cout << "Toggled object animation: " << (animateObjects ? "ON" : "OFF") << "\n";
+                }
+                else if (event.key.code == sf::Keyboard::T) {
+                    // Cycle tone curves; only the tonemap pass needs to rerun
+                    toneMapper = static_cast<rm::ToneMapper>((static_cast<int>(toneMapper) + 1) % 3);
+                    renderer.setToneMapper(toneMapper);
+                    renderer.tonemap();
+                    const char* names[] = {"Clamp", "Reinhard", "ACES"};
+                    std::cout << std::format("Tone mapper: {}\n", names[static_cast<int>(toneMapper)]);
+                }
             }
             else if (event.type == sf::Event::Resized) {
                 // Adjust viewport
@@ -194,17 +511,8 @@ int main() {
                 std::cout << "Auto camera moving: time = " << time << "\n";
             }
 
-            float radius = 15.0f; // Wider orbit
-            float camX = radius * std::sin(time * 0.2f);
-            float camZ = radius * std::cos(time * 0.2f);
-            float camY = 3.5f + std::sin(time * 0.3f) * 2.0f; // More dramatic height changes
-
-            rm::Vec3 newCameraPos = rm::Vec3(camX, camY, camZ);
-
-            // Look at a point that moves slightly
-            float targetX = std::sin(time * 0.15f) * 3.0f;
-            float targetZ = std::cos(time * 0.15f) * 3.0f;
-            rm::Vec3 newCameraTarget = rm::Vec3(targetX, 0.5f + std::sin(time * 0.4f) * 0.5f, targetZ);
+            rm::Vec3 newCameraPos, newCameraTarget;
+            orbitCamera(time, newCameraPos, newCameraTarget);
             
             // Only re-render if the camera has moved sufficiently
             if ((newCameraPos - cameraPos).length() > 0.01f || 
@@ -299,25 +607,52 @@ int main() {
             }
         }
 
+        // Bob the tori up and down; only their tiles are re-rendered
+        if (animateObjects) {
+            objectTime += 0.05f;
+            scene.setTranslation(torus1Id, rm::Vec3(0.0f, std::sin(objectTime) * 0.5f, 0.0f));
+            scene.setTranslation(torus2Id, rm::Vec3(0.0f, std::cos(objectTime) * 0.5f, 0.0f));
+            needsRender = true;
+        }
+
         // Update camera position and target
         camera.setPosition(cameraPos);
         camera.setTarget(cameraTarget);
+        updateLod(demo, camera, height);
 
         // Render if needed
         if (needsRender) {
             auto startRender = std::chrono::high_resolution_clock::now();
 
-            renderer.render(scene, camera);
-            renderSprite.setTexture(renderer.getTexture());
+            renderer.renderIncremental(scene, camera);
 
             auto endRender = std::chrono::high_resolution_clock::now();
             std::chrono::duration<double> renderTime = endRender - startRender;
-            std::cout << std::format("Render time: {:.2f}ms\n", renderTime.count() * 1000.0);
+            const auto& stats = renderer.getStats();
+            std::cout << std::format("Render time: {:.2f}ms  (reflection rays: {}, cut: {})\n",
+                                     renderTime.count() * 1000.0, stats.reflectionRays, stats.totalCut());
+            if (ambientOcclusion) {
+                std::cout << std::format("  AO: {} samples, {} cached, {:.1f}% of render time\n",
+                                         stats.aoSamples, stats.aoCacheHits, stats.aoFraction() * 100.0);
+            }
 
+            // renderIncremental picks up light edits through the scene's
+            // lighting revision, so a pending relight is done as well
             needsRender = false;
+            needsRelight = false;
+        }
+        else if (needsRelight) {
+            auto startRelight = std::chrono::high_resolution_clock::now();
+            renderer.relight(scene, camera);
+            std::chrono::duration<double> relightTime = std::chrono::high_resolution_clock::now() - startRelight;
+            std::cout << std::format("Relight time: {:.2f}ms\n", relightTime.count() * 1000.0);
+            needsRelight = false;
         }
 
         // Clear and draw
+        // The renderer uploads frames in the background; pick up the newest one
+        renderSprite.setTexture(renderer.getTexture());
+
         window.clear(sf::Color::Black);
         window.draw(renderSprite);
 
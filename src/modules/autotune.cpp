@@ -0,0 +1,246 @@
+module;
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+export module autotune;
+
+import common;
+import camera;
+import scene;
+import renderer;
+
+export namespace rm {
+
+// The settings the tuner searches over
+struct TuneConfig {
+    int threads = 0;        // Worker threads per pass; 0 = every hardware thread
+    int tileSize = 16;
+    int marchSteps = 100;   // Scene::setMaxMarchSteps
+};
+
+struct TuneResult {
+    TuneConfig config;
+    double frameMs = 0.0;   // Fastest calibration frame with the chosen config
+    double psnr = 0.0;      // Of that frame against the reference render, in dB
+    int configsTried = 0;
+    bool cached = false;    // Loaded from the cache file; nothing was rendered
+};
+
+// Opt-in startup calibration. Renders a few low-resolution frames of the
+// loaded scene over a small parameter grid and keeps the fastest setting
+// whose image stays above a PSNR threshold against a generous reference;
+// a setting must beat the best so far by a few percent to replace it.
+// The march step budget is searched first, being the only setting that
+// changes the image, then thread count and tile size together. Results are
+// cached in a text file keyed by machine and scene hash.
+class AutoTuner {
+public:
+    using Configure = std::function<void(Renderer&)>;
+    
+    explicit AutoTuner(std::string cachePath = "raymarch_tune.txt") : cachePath(std::move(cachePath)) {}
+    
+    // Lowest PSNR (dB) against the reference that still counts as the same image
+    void setQualityThreshold(double psnr) { minPsnr = psnr; }
+    
+    // Resolution of the calibration frames and how many are timed per setting
+    void setCalibration(int width, int height, int frames) {
+        calibrationWidth = std::max(width, 16);
+        calibrationHeight = std::max(height, 16);
+        calibrationFrames = std::max(frames, 1);
+    }
+    
+    // configure applies the application's own renderer settings (samples,
+    // denoise, bounces, sky) so calibration frames cost what real ones do
+    TuneResult tune(Scene& scene, const Camera& camera, const Configure& configure) {
+        const std::string key = std::format("{:016x} {:016x}", machineHash(), sceneHash(scene));
+        TuneResult result;
+        if (loadCached(key, result.config)) {
+            result.cached = true;
+            return result;
+        }
+        
+        Renderer renderer(calibrationWidth, calibrationHeight);
+        configure(renderer);
+        Camera view = camera;
+        view.setAspectRatio(static_cast<float>(calibrationWidth) / calibrationHeight);
+        
+        scene.setMaxMarchSteps(referenceSteps);
+        renderer.render(scene, view);
+        const size_t bytes = size_t(calibrationWidth) * calibrationHeight * 4;
+        const std::vector<uint8_t> reference(renderer.getPixels(), renderer.getPixels() + bytes);
+        
+        const int hardwareThreads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+        double bestMs = std::numeric_limits<double>::infinity();
+        auto consider = [&](const TuneConfig& config) {
+            apply(config, renderer, scene);
+            double frameMs = std::numeric_limits<double>::infinity();
+            for (int i = 0; i < calibrationFrames; ++i) {
+                auto start = std::chrono::steady_clock::now();
+                renderer.render(scene, view);
+                frameMs = std::min(frameMs, std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count());
+            }
+            const double quality = psnr(reference, renderer.getPixels());
+            result.configsTried++;
+            if (quality >= minPsnr && frameMs < bestMs * (1.0 - minGain)) {
+                bestMs = frameMs;
+                result.config = config;
+                result.frameMs = frameMs;
+                result.psnr = quality;
+            }
+        };
+        
+        // Step budget at the default scheduling, starting from the defaults;
+        // the reference budget always qualifies
+        for (int steps : {100, 48, 64, 160, referenceSteps}) {
+            consider(TuneConfig{hardwareThreads, 16, steps});
+        }
+        
+        // Scheduling at that budget
+        const int steps = result.config.marchSteps;
+        std::vector<int> threadCounts = {hardwareThreads, std::max(1, hardwareThreads / 2), hardwareThreads * 2};
+        threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+        for (int threads : threadCounts) {
+            for (int tileSize : {8, 16, 32}) {
+                if (threads == hardwareThreads && tileSize == 16) {
+                    continue;
+                }
+                consider(TuneConfig{threads, tileSize, steps});
+            }
+        }
+        
+        saveCached(key, result.config);
+        return result;
+    }
+    
+    static void apply(const TuneConfig& config, Renderer& renderer, Scene& scene) {
+        renderer.setThreadCount(config.threads);
+        renderer.setTileSize(config.tileSize);
+        scene.setMaxMarchSteps(config.marchSteps);
+    }
+
+private:
+    static constexpr int referenceSteps = 256;
+    
+    // FNV-1a over 64-bit words
+    static void mix(uint64_t& hash, uint64_t value) {
+        for (int i = 0; i < 8; ++i) {
+            hash = (hash ^ ((value >> (i * 8)) & 0xff)) * 0x100000001b3ull;
+        }
+    }
+    
+    static void mix(uint64_t& hash, const Vec3& v) {
+        mix(hash, std::bit_cast<uint32_t>(v.x));
+        mix(hash, std::bit_cast<uint32_t>(v.y));
+        mix(hash, std::bit_cast<uint32_t>(v.z));
+    }
+    
+    // CPU model, hardware threads and NUMA nodes
+    static uint64_t machineHash() {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        std::ifstream cpuinfo("/proc/cpuinfo");
+        std::string line;
+        while (std::getline(cpuinfo, line)) {
+            if (line.rfind("model name", 0) == 0) {
+                mix(hash, std::hash<std::string>{}(line));
+                break;
+            }
+        }
+        mix(hash, std::thread::hardware_concurrency());
+        mix(hash, NumaTopology::get().nodes.size());
+        return hash;
+    }
+    
+    // Object placement and extent plus lighting, which together decide
+    // where rays march and how many shadow rays they spawn
+    static uint64_t sceneHash(const Scene& scene) {
+        uint64_t hash = 0xcbf29ce484222325ull;
+        mix(hash, scene.getObjectCount());
+        for (ObjectId id = 0; id < scene.getObjectCount(); ++id) {
+            Bounds bounds = scene.getBounds(id);
+            mix(hash, bounds.min);
+            mix(hash, bounds.max);
+        }
+        for (const auto& light : scene.getLights()) {
+            mix(hash, light.position);
+            mix(hash, light.color);
+            mix(hash, std::bit_cast<uint32_t>(light.intensity));
+            mix(hash, std::bit_cast<uint32_t>(light.range));
+        }
+        mix(hash, static_cast<uint64_t>(scene.getLightSamples()));
+        return hash;
+    }
+    
+    static double psnr(const std::vector<uint8_t>& reference, const uint8_t* image) {
+        double squared = 0.0;
+        size_t count = 0;
+        for (size_t i = 0; i < reference.size(); i += 4) {
+            for (size_t c = 0; c < 3; ++c) {
+                double diff = double(reference[i + c]) - double(image[i + c]);
+                squared += diff * diff;
+            }
+            count += 3;
+        }
+        if (squared == 0.0) {
+            return std::numeric_limits<double>::infinity();
+        }
+        return 10.0 * std::log10(255.0 * 255.0 * count / squared);
+    }
+    
+    // One line per entry: machine hash, scene hash, threads, tile size, steps
+    bool loadCached(const std::string& key, TuneConfig& config) const {
+        std::ifstream file(cachePath);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.rfind(key + " ", 0) == 0) {
+                std::istringstream values(line.substr(key.size()));
+                TuneConfig cached;
+                if (values >> cached.threads >> cached.tileSize >> cached.marchSteps) {
+                    config = cached;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+    
+    void saveCached(const std::string& key, const TuneConfig& config) const {
+        std::vector<std::string> lines;
+        {
+            std::ifstream file(cachePath);
+            std::string line;
+            while (std::getline(file, line)) {
+                if (!line.empty() && line.rfind(key + " ", 0) != 0) {
+                    lines.push_back(line);
+                }
+            }
+        }
+        lines.push_back(std::format("{} {} {} {}", key, config.threads, config.tileSize, config.marchSteps));
+        
+        std::ofstream file(cachePath, std::ios::trunc);
+        for (const auto& line : lines) {
+            file << line << "\n";
+        }
+    }
+    
+    std::string cachePath;
+    double minPsnr = 48.0;
+    double minGain = 0.03;  // Below this, timing noise would pick the winner
+    int calibrationWidth = 320;
+    int calibrationHeight = 180;
+    int calibrationFrames = 3;
+};
+
+} // namespace rm
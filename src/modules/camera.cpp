@@ -2,6 +2,10 @@ module;
 
 #include <numbers>
 #include <cmath>
+#include <vector>
+#include <cstddef>
+#include <memory>
+#include <mutex>
 
 export module camera;
 
@@ -9,6 +13,11 @@ import common;
 
 export namespace rm {
 
+// Pixel rectangle [x0, x1) x [y0, y1)
+struct PixelRect {
+    int x0, y0, x1, y1;
+};
+
 class Camera {
 public:
     Camera(float fov, float aspect) : fov(fov), aspect(aspect) {
@@ -28,11 +37,13 @@ public:
     
     void setAspectRatio(float aspect) {
         this->aspect = aspect;
+        invalidateRayTable();
     }
     
     void setFOV(float fov) {
         this->fov = fov;
         tanHalfFov = std::tan(fov * 0.5f * std::numbers::pi_v<float> / 180.0f);
+        invalidateRayTable();
     }
     
     Ray getRay(float u, float v) const {
@@ -40,14 +51,130 @@ public:
         float nx = (2.0f * u - 1.0f) * aspect * tanHalfFov;
         float ny = (1.0f - 2.0f * v) * tanHalfFov;
         
-        Vec3 direction = forward + right * nx + up * ny;
-        return Ray(position, direction.normalize());
+        Vec3 direction = madd(up, ny, madd(right, nx, forward));
+        return Ray(position, direction.normalizeFast());
+    }
+    
+    // Sub-pixel offset of supersample s, shared by the ray table and callers
+    // that generate rays one at a time
+    static void sampleOffset(int s, float& dx, float& dy) {
+        dx = (s % 2) * 0.5f;
+        dy = (s / 2) * 0.5f;
     }
     
+    // Build the camera-space direction table for this resolution and sample
+    // count if it is not current. Only FOV and aspect changes invalidate it,
+    // so a moving camera reuses it every frame. Call before handing the
+    // camera to worker threads; getRays only reads the table.
+    void prepareRays(int width, int height, int samplesPerPixel) const {
+        if (width == tableWidth && height == tableHeight && samplesPerPixel == tableSamples) {
+            return;
+        }
+        
+        tableWidth = width;
+        tableHeight = height;
+        tableSamples = samplesPerPixel;
+        rayTable.reset();
+        
+        size_t count = size_t(width) * height * samplesPerPixel;
+        if (count > maxTableSamples) {
+            // Too large to be worth the memory; getRays computes directly
+            return;
+        }
+        
+        // The table is read-only once built, so every camera with the same
+        // parameters (e.g. the slots of a pipelined sequence) shares one
+        struct SharedTable {
+            int width, height, samples;
+            float fov, aspect;
+            std::weak_ptr<const std::vector<Vec3A>> table;
+        };
+        static std::mutex sharedMutex;
+        static std::vector<SharedTable> shared;
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        std::erase_if(shared, [](const SharedTable& entry) { return entry.table.expired(); });
+        for (const auto& entry : shared) {
+            if (entry.width == width && entry.height == height && entry.samples == samplesPerPixel &&
+                entry.fov == fov && entry.aspect == aspect) {
+                rayTable = entry.table.lock();
+                if (rayTable) {
+                    return;
+                }
+            }
+        }
+        
+        auto table = std::make_shared<std::vector<Vec3A>>(count);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                for (int s = 0; s < samplesPerPixel; ++s) {
+                    float dx, dy;
+                    sampleOffset(s, dx, dy);
+                    float nx = (2.0f * (x + dx) / float(width) - 1.0f) * aspect * tanHalfFov;
+                    float ny = (1.0f - 2.0f * (y + dy) / float(height)) * tanHalfFov;
+                    (*table)[(size_t(y) * width + x) * samplesPerPixel + s] = Vec3A(nx, ny, 1.0f).normalizeFast();
+                }
+            }
+        }
+        rayTable = table;
+        shared.push_back({width, height, samplesPerPixel, fov, aspect, rayTable});
+    }
+    
+    // Primary rays for every sample in a tile, row-major by pixel with the
+    // samples of one pixel adjacent. Uses the table from prepareRays, so per
+    // frame each ray costs one rotation into world space.
+    void getRays(const PixelRect& tile, std::vector<Ray>& rays) const {
+        rays.clear();
+        
+        if (!rayTable) {
+            for (int y = tile.y0; y < tile.y1; ++y) {
+                for (int x = tile.x0; x < tile.x1; ++x) {
+                    for (int s = 0; s < tableSamples; ++s) {
+                        float dx, dy;
+                        sampleOffset(s, dx, dy);
+                        rays.push_back(getRay((x + dx) / float(tableWidth), (y + dy) / float(tableHeight)));
+                    }
+                }
+            }
+            return;
+        }
+        
+        const Vec3A rightA = toVec3A(right);
+        const Vec3A upA = toVec3A(up);
+        const Vec3A forwardA = toVec3A(forward);
+        
+        for (int y = tile.y0; y < tile.y1; ++y) {
+            const Vec3A* row = &(*rayTable)[(size_t(y) * tableWidth + tile.x0) * tableSamples];
+            const int count = (tile.x1 - tile.x0) * tableSamples;
+            for (int i = 0; i < count; ++i) {
+                const Vec3A& d = row[i];
+                Vec3A world = madd(rightA, Vec3A::splat(d.x()), madd(upA, Vec3A::splat(d.y()), forwardA * d.z()));
+                rays.emplace_back(position, toVec3(world));
+            }
+        }
+    }
+    
+    // World point to camera space (right, up, forward)
+    Vec3 toView(const Vec3& point) const {
+        Vec3 d = point - position;
+        return Vec3(d.dot(right), d.dot(up), d.dot(forward));
+    }
+    
+    // Camera-space point (z > 0) to the [0,1] image coordinates used by getRay
+    Vec3 viewToScreen(const Vec3& view) const {
+        float u = (view.x / (view.z * aspect * tanHalfFov) + 1.0f) * 0.5f;
+        float v = (1.0f - view.y / (view.z * tanHalfFov)) * 0.5f;
+        return Vec3(u, v, view.z);
+    }
+    
+    // Angle one pixel subtends at the image center, for screen-space LOD
+    float getPixelAngle(int imageHeight) const { return 2.0f * tanHalfFov / imageHeight; }
+    
     const Vec3& getPosition() const { return position; }
     const Vec3& getForward() const { return forward; }
     const Vec3& getRight() const { return right; }
     const Vec3& getUp() const { return up; }
+    float getFOV() const { return fov; }
+    float getAspectRatio() const { return aspect; }
 
 private:
     void updateVectors() {
@@ -72,9 +199,22 @@ private:
     Vec3 right{1.0f, 0.0f, 0.0f};
     Vec3 up{0.0f, 1.0f, 0.0f};
     
+    void invalidateRayTable() {
+        tableWidth = tableHeight = tableSamples = 0;
+        rayTable.reset();
+    }
+
     float fov;
     float aspect;
     float tanHalfFov;
+    
+    // Camera-space sample directions, built lazily by prepareRays and
+    // shared between cameras with the same parameters
+    static constexpr size_t maxTableSamples = size_t(1) << 23;
+    mutable std::shared_ptr<const std::vector<Vec3A>> rayTable;
+    mutable int tableWidth = 0;
+    mutable int tableHeight = 0;
+    mutable int tableSamples = 0;
 };
 
 } // namespace rm
\ No newline at end of file
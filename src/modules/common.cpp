@@ -9,11 +9,37 @@ module;
 #include <algorithm>
 #include <format>
 #include <limits>
+#include <cstdint>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#define RM_SIMD_SSE 1
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RM_SIMD_NEON 1
+#endif
 
 export module common;
 
 export namespace rm {
 
+// 1/sqrt(x) from the hardware estimate refined by Newton-Raphson, accurate
+// to roughly 1e-6 relative; replaces a sqrt and a divide
+inline float fastRsqrt(float x) {
+#if defined(RM_SIMD_SSE)
+    float r = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+    return r * (1.5f - 0.5f * x * r * r);
+#elif defined(RM_SIMD_NEON)
+    float32x2_t v = vdup_n_f32(x);
+    float32x2_t r = vrsqrte_f32(v);
+    r = vmul_f32(r, vrsqrts_f32(vmul_f32(v, r), r));
+    r = vmul_f32(r, vrsqrts_f32(vmul_f32(v, r), r));
+    return vget_lane_f32(r, 0);
+#else
+    return 1.0f / std::sqrt(x);
+#endif
+}
+
 struct Vec3 {
     float x, y, z;
 
@@ -33,8 +59,174 @@ struct Vec3 {
     Vec3 cross(const Vec3& v) const { return Vec3(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x); }
     float length() const { return std::sqrt(x * x + y * y + z * z); }
     Vec3 normalize() const { return *this / length(); }
+    Vec3 normalizeFast() const { return *this * fastRsqrt(dot(*this)); }
+    
+    bool operator==(const Vec3& v) const = default;
+};
+
+// a * s + b
+inline Vec3 madd(const Vec3& a, float s, const Vec3& b) {
+    return Vec3(a.x * s + b.x, a.y * s + b.y, a.z * s + b.z);
+}
+
+// 16-byte aligned 4-lane float vector backed by SSE or NEON registers where
+// available. Used as Vec3A for 3-vectors, with w kept at zero so 4-lane
+// dot products and lengths equal their 3-lane counterparts.
+struct alignas(16) Vec4 {
+#if defined(RM_SIMD_SSE)
+    __m128 v;
+    
+    Vec4() : v(_mm_setzero_ps()) {}
+    explicit Vec4(__m128 v) : v(v) {}
+    Vec4(float x, float y, float z, float w = 0.0f) : v(_mm_set_ps(w, z, y, x)) {}
+    static Vec4 splat(float s) { return Vec4(_mm_set1_ps(s)); }
+    
+    // Four consecutive floats, no alignment required
+    static Vec4 load(const float* p) { return Vec4(_mm_loadu_ps(p)); }
+    void store(float* p) const { _mm_storeu_ps(p, v); }
+    
+    Vec4 operator+(const Vec4& o) const { return Vec4(_mm_add_ps(v, o.v)); }
+    Vec4 operator-(const Vec4& o) const { return Vec4(_mm_sub_ps(v, o.v)); }
+    Vec4 operator*(const Vec4& o) const { return Vec4(_mm_mul_ps(v, o.v)); }
+    Vec4 operator*(float s) const { return Vec4(_mm_mul_ps(v, _mm_set1_ps(s))); }
+    Vec4 operator/(const Vec4& o) const { return Vec4(_mm_div_ps(v, o.v)); }
+    
+    // Horizontal sum broadcast to every lane, so results stay in a register
+    Vec4 dotSplat(const Vec4& o) const {
+        __m128 m = _mm_mul_ps(v, o.v);
+        __m128 s = _mm_add_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+        return Vec4(_mm_add_ps(s, _mm_shuffle_ps(s, s, _MM_SHUFFLE(1, 0, 3, 2))));
+    }
+    float dot(const Vec4& o) const { return _mm_cvtss_f32(dotSplat(o).v); }
+    
+    Vec4 abs() const { return Vec4(_mm_andnot_ps(_mm_set1_ps(-0.0f), v)); }
+    Vec4 min(const Vec4& o) const { return Vec4(_mm_min_ps(v, o.v)); }
+    Vec4 max(const Vec4& o) const { return Vec4(_mm_max_ps(v, o.v)); }
+    
+    Vec4 normalizeFast() const {
+        __m128 d = dotSplat(*this).v;
+        __m128 r = _mm_rsqrt_ps(d);
+        // One Newton-Raphson step: r * (1.5 - 0.5 * d * r * r)
+        r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), d), _mm_mul_ps(r, r))));
+        return Vec4(_mm_mul_ps(v, r));
+    }
+    
+    float x() const { return _mm_cvtss_f32(v); }
+    float y() const { return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1))); }
+    float z() const { return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 2, 2, 2))); }
+    float w() const { return _mm_cvtss_f32(_mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3))); }
+#elif defined(RM_SIMD_NEON)
+    float32x4_t v;
+    
+    Vec4() : v(vdupq_n_f32(0.0f)) {}
+    explicit Vec4(float32x4_t v) : v(v) {}
+    Vec4(float x, float y, float z, float w = 0.0f) {
+        float lanes[4] = {x, y, z, w};
+        v = vld1q_f32(lanes);
+    }
+    static Vec4 splat(float s) { return Vec4(vdupq_n_f32(s)); }
+    
+    static Vec4 load(const float* p) { return Vec4(vld1q_f32(p)); }
+    void store(float* p) const { vst1q_f32(p, v); }
+    
+    Vec4 operator+(const Vec4& o) const { return Vec4(vaddq_f32(v, o.v)); }
+    Vec4 operator-(const Vec4& o) const { return Vec4(vsubq_f32(v, o.v)); }
+    Vec4 operator*(const Vec4& o) const { return Vec4(vmulq_f32(v, o.v)); }
+    Vec4 operator*(float s) const { return Vec4(vmulq_n_f32(v, s)); }
+#if defined(__aarch64__)
+    Vec4 operator/(const Vec4& o) const { return Vec4(vdivq_f32(v, o.v)); }
+#else
+    // 32-bit NEON has no divide: reciprocal estimate plus two Newton-Raphson steps
+    Vec4 operator/(const Vec4& o) const {
+        float32x4_t r = vrecpeq_f32(o.v);
+        r = vmulq_f32(r, vrecpsq_f32(o.v, r));
+        r = vmulq_f32(r, vrecpsq_f32(o.v, r));
+        return Vec4(vmulq_f32(v, r));
+    }
+#endif
+    
+    Vec4 dotSplat(const Vec4& o) const {
+        float32x4_t m = vmulq_f32(v, o.v);
+        float32x2_t s = vadd_f32(vget_low_f32(m), vget_high_f32(m));
+        s = vpadd_f32(s, s);
+        return Vec4(vcombine_f32(s, s));
+    }
+    float dot(const Vec4& o) const { return vgetq_lane_f32(dotSplat(o).v, 0); }
+    
+    Vec4 abs() const { return Vec4(vabsq_f32(v)); }
+    Vec4 min(const Vec4& o) const { return Vec4(vminq_f32(v, o.v)); }
+    Vec4 max(const Vec4& o) const { return Vec4(vmaxq_f32(v, o.v)); }
+    
+    Vec4 normalizeFast() const {
+        float32x4_t d = dotSplat(*this).v;
+        float32x4_t r = vrsqrteq_f32(d);
+        r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(d, r), r));
+        r = vmulq_f32(r, vrsqrtsq_f32(vmulq_f32(d, r), r));
+        return Vec4(vmulq_f32(v, r));
+    }
+    
+    float x() const { return vgetq_lane_f32(v, 0); }
+    float y() const { return vgetq_lane_f32(v, 1); }
+    float z() const { return vgetq_lane_f32(v, 2); }
+    float w() const { return vgetq_lane_f32(v, 3); }
+#else
+    float lanes[4];
+    
+    Vec4() : lanes{0.0f, 0.0f, 0.0f, 0.0f} {}
+    Vec4(float x, float y, float z, float w = 0.0f) : lanes{x, y, z, w} {}
+    static Vec4 splat(float s) { return Vec4(s, s, s, s); }
+    
+    static Vec4 load(const float* p) { return Vec4(p[0], p[1], p[2], p[3]); }
+    void store(float* p) const { std::copy(lanes, lanes + 4, p); }
+    
+    template <typename Op>
+    Vec4 map(const Vec4& o, Op op) const {
+        return Vec4(op(lanes[0], o.lanes[0]), op(lanes[1], o.lanes[1]), op(lanes[2], o.lanes[2]), op(lanes[3], o.lanes[3]));
+    }
+    
+    Vec4 operator+(const Vec4& o) const { return map(o, [](float a, float b) { return a + b; }); }
+    Vec4 operator-(const Vec4& o) const { return map(o, [](float a, float b) { return a - b; }); }
+    Vec4 operator*(const Vec4& o) const { return map(o, [](float a, float b) { return a * b; }); }
+    Vec4 operator*(float s) const { return *this * splat(s); }
+    Vec4 operator/(const Vec4& o) const { return map(o, [](float a, float b) { return a / b; }); }
+    
+    Vec4 dotSplat(const Vec4& o) const { return splat(dot(o)); }
+    float dot(const Vec4& o) const {
+        return lanes[0] * o.lanes[0] + lanes[1] * o.lanes[1] + lanes[2] * o.lanes[2] + lanes[3] * o.lanes[3];
+    }
+    
+    Vec4 abs() const { return map(*this, [](float a, float) { return std::abs(a); }); }
+    Vec4 min(const Vec4& o) const { return map(o, [](float a, float b) { return std::min(a, b); }); }
+    Vec4 max(const Vec4& o) const { return map(o, [](float a, float b) { return std::max(a, b); }); }
+    
+    Vec4 normalizeFast() const { return *this * fastRsqrt(dot(*this)); }
+    
+    float x() const { return lanes[0]; }
+    float y() const { return lanes[1]; }
+    float z() const { return lanes[2]; }
+    float w() const { return lanes[3]; }
+#endif
+    
+    float lengthSquared() const { return dot(*this); }
+    float length() const { return std::sqrt(dot(*this)); }
 };
 
+using Vec3A = Vec4;
+
+inline Vec3A toVec3A(const Vec3& v) { return Vec3A(v.x, v.y, v.z); }
+inline Vec3 toVec3(const Vec3A& v) { return Vec3(v.x(), v.y(), v.z()); }
+
+// a * b + c, a single fused instruction where the target has FMA
+inline Vec4 madd(const Vec4& a, const Vec4& b, const Vec4& c) {
+#if defined(RM_SIMD_SSE) && defined(__FMA__)
+    return Vec4(_mm_fmadd_ps(a.v, b.v, c.v));
+#elif defined(RM_SIMD_NEON)
+    return Vec4(vmlaq_f32(c.v, a.v, b.v));
+#else
+    return a * b + c;
+#endif
+}
+
 struct Ray {
     Vec3 origin;
     Vec3 direction;
@@ -44,6 +236,132 @@ struct Ray {
     Vec3 at(float t) const { return origin + direction * t; }
 };
 
+// Axis-aligned bounding box; unbounded shapes (planes, repetition) use infinite()
+struct Bounds {
+    Vec3 min;
+    Vec3 max;
+    
+    Bounds() : min(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()),
+               max(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max(), -std::numeric_limits<float>::max()) {}
+    Bounds(const Vec3& min, const Vec3& max) : min(min), max(max) {}
+    
+    static Bounds infinite() {
+        const float inf = std::numeric_limits<float>::infinity();
+        return Bounds(Vec3(-inf, -inf, -inf), Vec3(inf, inf, inf));
+    }
+    static Bounds around(const Vec3& center, const Vec3& halfExtent) {
+        return Bounds(center - halfExtent, center + halfExtent);
+    }
+    
+    bool isEmpty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+    bool isInfinite() const {
+        return !std::isfinite(min.x) || !std::isfinite(min.y) || !std::isfinite(min.z) ||
+               !std::isfinite(max.x) || !std::isfinite(max.y) || !std::isfinite(max.z);
+    }
+    
+    Vec3 center() const { return (min + max) * 0.5f; }
+    Vec3 corner(int i) const {
+        return Vec3((i & 1) ? max.x : min.x, (i & 2) ? max.y : min.y, (i & 4) ? max.z : min.z);
+    }
+    
+    Bounds merge(const Bounds& b) const {
+        return Bounds(Vec3(std::min(min.x, b.min.x), std::min(min.y, b.min.y), std::min(min.z, b.min.z)),
+                      Vec3(std::max(max.x, b.max.x), std::max(max.y, b.max.y), std::max(max.z, b.max.z)));
+    }
+    Bounds intersect(const Bounds& b) const {
+        return Bounds(Vec3(std::max(min.x, b.min.x), std::max(min.y, b.min.y), std::max(min.z, b.min.z)),
+                      Vec3(std::min(max.x, b.max.x), std::min(max.y, b.max.y), std::min(max.z, b.max.z)));
+    }
+    Bounds expand(float amount) const {
+        Vec3 e(amount, amount, amount);
+        return Bounds(min - e, max + e);
+    }
+    Bounds translate(const Vec3& offset) const { return Bounds(min + offset, max + offset); }
+    
+    // Squared distance from a point to the box, zero inside; bounds the
+    // distance to anything contained in it from below
+    float distanceSquaredTo(const Vec3& p) const {
+        Vec3 d(std::max(std::max(min.x - p.x, p.x - max.x), 0.0f),
+               std::max(std::max(min.y - p.y, p.y - max.y), 0.0f),
+               std::max(std::max(min.z - p.z, p.z - max.z), 0.0f));
+        return d.dot(d);
+    }
+    float distanceTo(const Vec3& p) const { return std::sqrt(distanceSquaredTo(p)); }
+};
+
+// Rigid transform with uniform scale (keeps SDFs exact), inverse precomputed
+struct Transform {
+    // Columns of the rotation matrix
+    Vec3 axisX{1.0f, 0.0f, 0.0f};
+    Vec3 axisY{0.0f, 1.0f, 0.0f};
+    Vec3 axisZ{0.0f, 0.0f, 1.0f};
+    Vec3 translation{0.0f, 0.0f, 0.0f};
+    float scale = 1.0f;
+    float invScale = 1.0f;
+    
+    static Transform translate(const Vec3& offset) {
+        Transform t;
+        t.translation = offset;
+        return t;
+    }
+    
+    static Transform rotate(const Vec3& axis, float degrees) {
+        Vec3 n = axis.normalize();
+        float angle = degrees * std::numbers::pi_v<float> / 180.0f;
+        float c = std::cos(angle);
+        float s = std::sin(angle);
+        float k = 1.0f - c;
+        
+        Transform t;
+        t.axisX = Vec3(c + n.x * n.x * k, n.y * n.x * k + n.z * s, n.z * n.x * k - n.y * s);
+        t.axisY = Vec3(n.x * n.y * k - n.z * s, c + n.y * n.y * k, n.z * n.y * k + n.x * s);
+        t.axisZ = Vec3(n.x * n.z * k + n.y * s, n.y * n.z * k - n.x * s, c + n.z * n.z * k);
+        return t;
+    }
+    
+    static Transform uniformScale(float factor) {
+        Transform t;
+        t.scale = factor;
+        t.invScale = 1.0f / factor;
+        return t;
+    }
+    
+    Vec3 rotateVector(const Vec3& v) const { return axisX * v.x + axisY * v.y + axisZ * v.z; }
+    Vec3 inverseRotateVector(const Vec3& v) const { return Vec3(axisX.dot(v), axisY.dot(v), axisZ.dot(v)); }
+    
+    bool isTranslation() const {
+        return axisX == Vec3(1.0f, 0.0f, 0.0f) && axisY == Vec3(0.0f, 1.0f, 0.0f) &&
+               axisZ == Vec3(0.0f, 0.0f, 1.0f) && scale == 1.0f;
+    }
+    
+    Vec3 apply(const Vec3& p) const { return rotateVector(p) * scale + translation; }
+    Vec3 applyInverse(const Vec3& p) const { return inverseRotateVector(p - translation) * invScale; }
+    
+    Bounds apply(const Bounds& b) const {
+        if (b.isEmpty() || b.isInfinite()) {
+            return b;
+        }
+        Bounds result;
+        for (int i = 0; i < 8; ++i) {
+            Vec3 p = apply(b.corner(i));
+            result = result.merge(Bounds(p, p));
+        }
+        return result;
+    }
+    
+    // this * other applies other first, then this
+    Transform operator*(const Transform& other) const {
+        Transform t;
+        t.axisX = rotateVector(other.axisX);
+        t.axisY = rotateVector(other.axisY);
+        t.axisZ = rotateVector(other.axisZ);
+        t.translation = apply(other.translation);
+        t.scale = scale * other.scale;
+        t.invScale = invScale * other.invScale;
+        return t;
+    }
+};
+
 struct Material {
     Vec3 albedo;  // Base color
     float metallic;  // 0 = dielectric, 1 = metallic
@@ -55,24 +373,117 @@ struct Material {
         : albedo(albedo), metallic(metallic), roughness(roughness), emissive(emissive) {}
 };
 
+// Unit vector packed into 32 bits: octahedral mapping with 16 bits per
+// coordinate, accurate to about 0.005 degrees
+inline uint32_t encodeOctahedral(const Vec3& n) {
+    float invL1 = 1.0f / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+    float u = n.x * invL1;
+    float v = n.y * invL1;
+    if (n.z < 0.0f) {
+        // Fold the lower hemisphere over the diagonals
+        float fu = (1.0f - std::abs(v)) * (u >= 0.0f ? 1.0f : -1.0f);
+        float fv = (1.0f - std::abs(u)) * (v >= 0.0f ? 1.0f : -1.0f);
+        u = fu;
+        v = fv;
+    }
+    auto quantize = [](float f) {
+        return static_cast<uint32_t>(std::lround((std::clamp(f, -1.0f, 1.0f) * 0.5f + 0.5f) * 65535.0f));
+    };
+    return quantize(u) | (quantize(v) << 16);
+}
+
+inline Vec3 decodeOctahedral(uint32_t bits) {
+    float u = (bits & 0xffffu) * (2.0f / 65535.0f) - 1.0f;
+    float v = (bits >> 16) * (2.0f / 65535.0f) - 1.0f;
+    Vec3 n(u, v, 1.0f - std::abs(u) - std::abs(v));
+    float fold = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -fold : fold;
+    n.y += n.y >= 0.0f ? -fold : fold;
+    return n.normalize();
+}
+
+// Index into a scene's material table
+using MaterialId = uint16_t;
+
+// Result of a successful march. The normal is not stored: Scene::normal
+// computes it on demand, so rays that only need the hit point skip it.
 struct Hit {
     float distance;
     Vec3 position;
-    Vec3 normal;
-    Material material;
+    uint32_t object;      // Index of the scene object that was hit
+    MaterialId material;  // Index into the scene material table
+    
+    Hit() : distance(std::numeric_limits<float>::max()), object(0), material(0) {}
+};
+
+// Tone mapping curves applied to exposed HDR values before sRGB encoding
+enum class ToneMapper {
+    Clamp,     // Hard clip to [0,1]
+    Reinhard,  // x / (1 + x)
+    ACES       // Narkowicz fit of the ACES filmic curve
+};
+
+template <ToneMapper Curve>
+inline float toneMap(float x) {
+    if constexpr (Curve == ToneMapper::Reinhard) {
+        return x / (1.0f + x);
+    } else if constexpr (Curve == ToneMapper::ACES) {
+        return (x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f);
+    } else {
+        return x;
+    }
+}
+
+// The same curves on four values at once
+template <ToneMapper Curve>
+inline Vec4 toneMap(const Vec4& x) {
+    if constexpr (Curve == ToneMapper::Reinhard) {
+        return x / (x + Vec4::splat(1.0f));
+    } else if constexpr (Curve == ToneMapper::ACES) {
+        return (x * madd(x, Vec4::splat(2.51f), Vec4::splat(0.03f))) /
+               madd(x, madd(x, Vec4::splat(2.43f), Vec4::splat(0.59f)), Vec4::splat(0.14f));
+    } else {
+        return x;
+    }
+}
+
+// Linear [0,1] to 8-bit sRGB via a lookup table, replacing per-channel std::pow
+class SrgbLut {
+public:
+    static constexpr int size = 4096;
+    
+    static const SrgbLut& get() {
+        static const SrgbLut lut;
+        return lut;
+    }
     
-    Hit() : distance(std::numeric_limits<float>::max()) {}
+    static uint8_t encode(float linear) {
+        float x = std::clamp(linear, 0.0f, 1.0f);
+        return get()[static_cast<int>(x * (size - 1) + 0.5f)];
+    }
+    
+    // Entry for a value already clamped and scaled to [0, size - 1]
+    uint8_t operator[](int index) const { return table[index]; }
+    
+private:
+    SrgbLut() {
+        for (int i = 0; i < size; ++i) {
+            float x = i / float(size - 1);
+            float s = x <= 0.0031308f ? 12.92f * x : 1.055f * std::pow(x, 1.0f / 2.4f) - 0.055f;
+            table[i] = static_cast<uint8_t>(std::clamp(s, 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+    }
+    
+    std::array<uint8_t, size> table;
 };
 
 // Convert Vec3 to SFML Color
 inline sf::Color toColor(const Vec3& v, float exposure = 1.0f) {
-    auto gamma = [](float x) { return std::pow(std::clamp(x, 0.0f, 1.0f), 1.0f / 2.2f); };
-    
     Vec3 exposed = v * exposure;
     return sf::Color(
-        static_cast<uint8_t>(gamma(exposed.x) * 255),
-        static_cast<uint8_t>(gamma(exposed.y) * 255),
-        static_cast<uint8_t>(gamma(exposed.z) * 255)
+        SrgbLut::encode(exposed.x),
+        SrgbLut::encode(exposed.y),
+        SrgbLut::encode(exposed.z)
     );
 }
 
@@ -0,0 +1,307 @@
+module;
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+export module framering;
+
+export namespace rm {
+
+// Per-frame metadata stored next to each slot's pixels
+struct SharedFrameInfo {
+    uint64_t frame = 0;        // 1-based publish count
+    uint64_t timestampNs = 0;  // steady_clock (CLOCK_MONOTONIC) at publish
+    uint32_t width = 0;
+    uint32_t height = 0;
+    float exposure = 1.0f;
+};
+
+// Shared-memory layout: one ring header, then slotCount page-aligned slots,
+// each a SharedSlotHeader followed by width x height RGBA8 pixels
+struct SharedRingHeader {
+    static constexpr uint32_t kMagic = 0x524d4652; // "RMFR"
+    static constexpr uint32_t kVersion = 2;
+    
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pixelOffset;  // From slot start to its pixels
+    int32_t writerPid;     // Process that created the ring, so a new writer can tell a live ring from a crashed one
+    uint64_t slotStride;   // Bytes between slots
+    uint64_t firstSlot;    // From mapping start to slot 0
+    std::atomic<uint64_t> published;  // Frames completed; the newest is in slot (published - 1) % slotCount
+};
+
+// Seqlock: sequence is odd while the renderer writes the slot. A reader that
+// sees the same even value before and after touching the slot got a whole frame.
+struct alignas(64) SharedSlotHeader {
+    std::atomic<uint64_t> sequence;
+    SharedFrameInfo info;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "seqlock needs lock-free 64-bit atomics");
+
+// Writer side: owns the shared-memory object and unlinks it on destruction.
+// Rendering writes straight into the slot between beginWrite and endWrite,
+// so publishing costs no extra pass over the frame. POSIX shared memory is
+// only wired up on Linux; elsewhere both ends throw on construction.
+class SharedFrameRing {
+public:
+    SharedFrameRing(const std::string& name, int width, int height, int slots = 3) : name(name) {
+#ifdef __linux__
+        const uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        const uint64_t pixelOffset = sizeof(SharedSlotHeader);
+        const uint64_t slotStride = roundUp(pixelOffset + uint64_t(width) * height * 4, page);
+        const uint64_t firstSlot = roundUp(sizeof(SharedRingHeader), page);
+        slotCount = std::max(slots, 2);
+        size = firstSlot + slotStride * slotCount;
+        
+        // Always start from a fresh object so readers never see a stale or
+        // half-written slot. A ring left by a crashed run is replaced; one
+        // whose writer is still running is not.
+        int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (fd < 0 && errno == EEXIST) {
+            removeStale(name);
+            fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        }
+        if (fd < 0) {
+            throw std::runtime_error("shm_open failed for " + name);
+        }
+        if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            close(fd);
+            shm_unlink(name.c_str());
+            throw std::runtime_error("Could not size shared frame ring " + name);
+        }
+        void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            shm_unlink(name.c_str());
+            throw std::runtime_error("Could not map shared frame ring " + name);
+        }
+        base = static_cast<uint8_t*>(mapped);
+        
+        // Every slot starts at an even sequence; readers check the magic,
+        // which is written last
+        header = new (base) SharedRingHeader{};
+        header->version = SharedRingHeader::kVersion;
+        header->slotCount = static_cast<uint32_t>(slotCount);
+        header->width = static_cast<uint32_t>(width);
+        header->height = static_cast<uint32_t>(height);
+        header->pixelOffset = static_cast<uint32_t>(pixelOffset);
+        header->writerPid = static_cast<int32_t>(getpid());
+        header->slotStride = slotStride;
+        header->firstSlot = firstSlot;
+        header->published.store(0, std::memory_order_relaxed);
+        for (int i = 0; i < slotCount; ++i) {
+            new (slot(i)) SharedSlotHeader{};
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        header->magic = SharedRingHeader::kMagic;
+#else
+        (void)width;
+        (void)height;
+        (void)slots;
+        throw std::runtime_error("Shared frame rings are not supported on this platform");
+#endif
+    }
+    
+    ~SharedFrameRing() {
+#ifdef __linux__
+        munmap(base, size);
+        shm_unlink(name.c_str());
+#endif
+    }
+    
+    SharedFrameRing(const SharedFrameRing&) = delete;
+    SharedFrameRing& operator=(const SharedFrameRing&) = delete;
+    
+    // Open the next slot for writing and return its RGBA8 pixels
+    uint8_t* beginWrite() {
+        const uint64_t next = header->published.load(std::memory_order_relaxed);
+        writing = slot(static_cast<int>(next % slotCount));
+        writing->sequence.store(writing->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        return reinterpret_cast<uint8_t*>(writing) + header->pixelOffset;
+    }
+    
+    // Close the slot opened by beginWrite and make it the latest frame
+    void endWrite(float exposure) {
+        const uint64_t frame = header->published.load(std::memory_order_relaxed) + 1;
+        writing->info.frame = frame;
+        writing->info.timestampNs = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+        writing->info.width = header->width;
+        writing->info.height = header->height;
+        writing->info.exposure = exposure;
+        writing->sequence.store(writing->sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        header->published.store(frame, std::memory_order_release);
+        writing = nullptr;
+    }
+    
+    const std::string& getName() const { return name; }
+
+private:
+    static uint64_t roundUp(uint64_t value, uint64_t alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+    
+#ifdef __linux__
+    // Unlink an existing ring only if it is provably stale: a complete
+    // header of this version whose writer process is gone. Anything else
+    // may belong to a live writer, possibly one still initializing it.
+    static void removeStale(const std::string& name) {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            return;  // Removed in the meantime
+        }
+        struct stat info {};
+        void* mapped = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(SharedRingHeader)) {
+            mapped = mmap(nullptr, sizeof(SharedRingHeader), PROT_READ, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            throw std::runtime_error("Shared frame ring " + name + " already exists and is not initialized; "
+                                     "remove /dev/shm" + name + " if no renderer is using it");
+        }
+        const auto* existing = static_cast<const SharedRingHeader*>(mapped);
+        const bool valid = existing->magic == SharedRingHeader::kMagic &&
+                           existing->version == SharedRingHeader::kVersion;
+        const pid_t pid = static_cast<pid_t>(existing->writerPid);
+        munmap(mapped, sizeof(SharedRingHeader));
+        
+        if (!valid) {
+            throw std::runtime_error("Shared frame ring " + name + " already exists with an unknown layout; "
+                                     "remove /dev/shm" + name + " if no renderer is using it");
+        }
+        if (pid <= 0 || kill(pid, 0) == 0 || errno != ESRCH) {
+            throw std::runtime_error("Shared frame ring " + name + " is in use by process " + std::to_string(pid));
+        }
+        shm_unlink(name.c_str());
+    }
+#endif
+    
+    SharedSlotHeader* slot(int index) {
+        return reinterpret_cast<SharedSlotHeader*>(base + header->firstSlot + header->slotStride * index);
+    }
+    
+    std::string name;
+    uint8_t* base = nullptr;
+    size_t size = 0;
+    int slotCount = 0;
+    SharedRingHeader* header = nullptr;
+    SharedSlotHeader* writing = nullptr;
+};
+
+// Reader side: maps an existing ring read-only. Reads take no locks and make
+// no system calls, so any number of local processes can follow the renderer.
+class SharedFrameReader {
+public:
+    explicit SharedFrameReader(const std::string& name) {
+#ifdef __linux__
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd < 0) {
+            throw std::runtime_error("No shared frame ring named " + name);
+        }
+        struct stat info {};
+        if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(SharedRingHeader)) {
+            close(fd);
+            throw std::runtime_error("Shared frame ring " + name + " is not initialized");
+        }
+        size = static_cast<size_t>(info.st_size);
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            throw std::runtime_error("Could not map shared frame ring " + name);
+        }
+        base = static_cast<const uint8_t*>(mapped);
+        header = reinterpret_cast<const SharedRingHeader*>(base);
+        
+        if (header->magic != SharedRingHeader::kMagic || header->version != SharedRingHeader::kVersion ||
+            header->firstSlot + header->slotStride * header->slotCount > size) {
+            munmap(const_cast<uint8_t*>(base), size);
+            throw std::runtime_error("Shared frame ring " + name + " has an unknown layout");
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+#else
+        throw std::runtime_error("No shared frame ring named " + name + ": not supported on this platform");
+#endif
+    }
+    
+    ~SharedFrameReader() {
+#ifdef __linux__
+        munmap(const_cast<uint8_t*>(base), size);
+#endif
+    }
+    
+    SharedFrameReader(const SharedFrameReader&) = delete;
+    SharedFrameReader& operator=(const SharedFrameReader&) = delete;
+    
+    int getWidth() const { return static_cast<int>(header->width); }
+    int getHeight() const { return static_cast<int>(header->height); }
+    int getSlotCount() const { return static_cast<int>(header->slotCount); }
+    
+    // Number of frames published so far; poll this to wait for a new frame
+    uint64_t getPublished() const { return header->published.load(std::memory_order_acquire); }
+    
+    // Call fn(pixels, info) on the newest frame in place. Returns false if
+    // nothing is published yet or the renderer overwrote the slot while fn
+    // ran, in which case whatever fn read must be discarded.
+    template <typename Fn>
+    bool view(Fn&& fn) const {
+        const uint64_t published = getPublished();
+        if (published == 0) {
+            return false;
+        }
+        const auto* slot = reinterpret_cast<const SharedSlotHeader*>(
+            base + header->firstSlot + header->slotStride * ((published - 1) % header->slotCount));
+        
+        const uint64_t before = slot->sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            return false;
+        }
+        SharedFrameInfo info = slot->info;
+        fn(reinterpret_cast<const uint8_t*>(slot) + header->pixelOffset, info);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot->sequence.load(std::memory_order_relaxed) == before;
+    }
+    
+    // Copy the newest whole frame, retrying if the renderer laps the reader
+    bool copyLatest(std::vector<uint8_t>& pixels, SharedFrameInfo& info, int attempts = 8) const {
+        pixels.resize(size_t(header->width) * header->height * 4);
+        for (int i = 0; i < attempts; ++i) {
+            if (view([&](const uint8_t* src, const SharedFrameInfo& frame) {
+                    std::memcpy(pixels.data(), src, pixels.size());
+                    info = frame;
+                })) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    const uint8_t* base = nullptr;
+    size_t size = 0;
+    const SharedRingHeader* header = nullptr;
+};
+
+} // namespace rm
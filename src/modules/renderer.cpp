@@ -6,109 +6,1578 @@ module;
 #include <vector>
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <string>
+#include <cstring>
+#include <chrono>
+#include <bit>
 #include <format>
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <new>
+#include <type_traits>
 #include <cmath>   // Added for pow and other math functions
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 export module renderer;
 
 import common;
 import scene;
 import camera;
+import framering;
 
 export namespace rm {
 
+// Per-frame counters for reflection bounce rays and ambient occlusion cost
+struct RenderStats {
+    int reflectionRays = 0;   // Bounce rays actually traced
+    int cutByThroughput = 0;  // Dropped because their weight was negligible
+    int cutByRoulette = 0;    // Killed by Russian roulette
+    int cutByBudget = 0;      // Replaced by the sky once the frame budget ran out
+    
+    int aoSamples = 0;        // 5-tap occlusion evaluations
+    int aoCacheHits = 0;      // Occlusion values reused from earlier frames
+    double aoSeconds = 0.0;   // Thread time spent on occlusion, prepass included
+    double workSeconds = 0.0; // Thread time spent rendering in total
+    
+    int totalCut() const { return cutByThroughput + cutByRoulette + cutByBudget; }
+    double aoFraction() const { return workSeconds > 0.0 ? aoSeconds / workSeconds : 0.0; }
+    
+    RenderStats& operator+=(const RenderStats& other) {
+        reflectionRays += other.reflectionRays;
+        cutByThroughput += other.cutByThroughput;
+        cutByRoulette += other.cutByRoulette;
+        cutByBudget += other.cutByBudget;
+        aoSamples += other.aoSamples;
+        aoCacheHits += other.aoCacheHits;
+        aoSeconds += other.aoSeconds;
+        workSeconds += other.workSeconds;
+        return *this;
+    }
+};
+
+// CPUs grouped by NUMA node, read once from sysfs and limited to the CPUs
+// this process may run on. Without NUMA (or sysfs) there is one node and
+// no pinning, so scheduling stays exactly as it was.
+struct NumaTopology {
+    std::vector<std::vector<int>> nodes;
+    
+    static const NumaTopology& get() {
+        static const NumaTopology topology = discover();
+        return topology;
+    }
+    
+    bool isNuma() const { return nodes.size() > 1; }
+    
+    // Restrict the calling thread to one node's CPUs
+    void bindCurrentThread(int node) const {
+#ifdef __linux__
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu : nodes[node]) {
+            CPU_SET(cpu, &set);
+        }
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+        (void)node;
+#endif
+    }
+    
+private:
+    static NumaTopology discover() {
+        NumaTopology topology;
+#ifdef __linux__
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        const bool masked = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+        
+        for (int node = 0;; ++node) {
+            std::ifstream file(std::format("/sys/devices/system/node/node{}/cpulist", node));
+            if (!file) {
+                break;
+            }
+            // Ranges such as "0-15,32-47"
+            std::vector<int> cpus;
+            std::string range;
+            while (std::getline(file, range, ',')) {
+                int first = 0, last = -1;
+                char dash = 0;
+                std::istringstream parse(range);
+                if (!(parse >> first)) {
+                    continue;
+                }
+                last = (parse >> dash >> last) && dash == '-' ? last : first;
+                for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+                    if (!masked || CPU_ISSET(cpu, &allowed)) {
+                        cpus.push_back(cpu);
+                    }
+                }
+            }
+            // Memory-only nodes have no CPUs to schedule
+            if (!cpus.empty()) {
+                topology.nodes.push_back(std::move(cpus));
+            }
+        }
+#endif
+        if (topology.nodes.size() < 2) {
+            topology.nodes.assign(1, {});
+        }
+        return topology;
+    }
+};
+
+// Leaves elements of trivial types uninitialized on resize, so a buffer's
+// pages are first touched, and so placed, by the threads that fill them
+template <typename T>
+struct FirstTouchAllocator : std::allocator<T> {
+    template <typename U>
+    struct rebind { using other = FirstTouchAllocator<U>; };
+    
+    FirstTouchAllocator() = default;
+    template <typename U>
+    FirstTouchAllocator(const FirstTouchAllocator<U>&) noexcept {}
+    
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args) {
+        if constexpr (sizeof...(Args) > 0 || !std::is_trivially_copyable_v<U>) {
+            ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+        }
+    }
+};
+
+// Per-pixel buffers written by the render workers
+template <typename T>
+using PixelBuffer = std::vector<T, FirstTouchAllocator<T>>;
+
+// Worker threads that live as long as their renderer, in one group per NUMA
+// node, each pinned to its node's CPUs when pinning is on. A pass runs a task
+// on every worker and returns once all of them are done, so threads, their
+// placement and their thread_local scratch survive from pass to pass.
+class WorkerPool {
+public:
+    WorkerPool(std::vector<int> threadsPerNode, bool pinned)
+        : threadsPerNode(std::move(threadsPerNode)), pinned(pinned) {
+        for (int node = 0; node < static_cast<int>(this->threadsPerNode.size()); ++node) {
+            for (int t = 0; t < this->threadsPerNode[node]; ++t) {
+                threads.emplace_back([this, node] { workLoop(node); });
+            }
+        }
+    }
+    
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        start.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    
+    bool matches(const std::vector<int>& counts, bool pin) const {
+        return counts == threadsPerNode && pin == pinned;
+    }
+    
+    int getNodeCount() const { return static_cast<int>(threadsPerNode.size()); }
+    
+    // Run task(node) on every worker; one pass at a time
+    void run(const std::function<void(int)>& task) {
+        std::unique_lock<std::mutex> lock(mutex);
+        current = &task;
+        running = static_cast<int>(threads.size());
+        generation++;
+        start.notify_all();
+        done.wait(lock, [&] { return running == 0; });
+        current = nullptr;
+    }
+
+private:
+    void workLoop(int node) {
+        if (pinned) {
+            NumaTopology::get().bindCurrentThread(node);
+        }
+        uint64_t seen = 0;
+        while (true) {
+            const std::function<void(int)>* task;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                start.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+                task = current;
+            }
+            
+            (*task)(node);
+            
+            bool last;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                last = --running == 0;
+            }
+            if (last) {
+                done.notify_one();
+            }
+        }
+    }
+    
+    std::vector<int> threadsPerNode;
+    bool pinned;
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable start;
+    std::condition_variable done;
+    const std::function<void(int)>* current = nullptr;
+    uint64_t generation = 0;
+    int running = 0;
+    bool stopping = false;
+};
+
 class Renderer {
 public:
     Renderer(int width, int height) : width(width), height(height) {
         image.create(width, height);
-        textureNeedsUpdate = true;
+        
+        // Filled by the workers rather than here, so on NUMA machines each
+        // node's rows start out in its own memory
+        resizePixels(hdrBuffer, size_t(width) * height, Vec3(0.0f, 0.0f, 0.0f));
+        for (auto& buffer : staging) {
+            resizePixels(buffer, size_t(width) * height * 4, sf::Uint8(255));
+        }
+        
+        tilesX = (width + tileSize - 1) / tileSize;
+        tilesY = (height + tileSize - 1) / tileSize;
+        tileReflective.assign(tilesX * tilesY, 0);
+        
+        aoWidth = (width + 1) / 2;
+        aoHeight = (height + 1) / 2;
+        resizePixels(aoValues, size_t(aoWidth) * aoHeight, 1.0f);
+        resizePixels(aoDepths, size_t(aoWidth) * aoHeight, std::numeric_limits<float>::infinity());
+        resizePixels(aoNormals, size_t(aoWidth) * aoHeight, Vec3(0, 0, 0));
+    }
+    
+    ~Renderer() {
+        {
+            std::lock_guard<std::mutex> lock(uploadMutex);
+            stopUploader = true;
+        }
+        uploadReady.notify_all();
+        if (uploader.joinable()) {
+            uploader.join();
+        }
     }
     
     void render(const Scene& scene, const Camera& camera) {
-        // Multi-threaded rendering
-        const int numThreads = std::thread::hardware_concurrency();
-        std::vector<std::thread> threads;
-        std::atomic<int> nextRow(0);
-        
-        // Store thread-local pixel data
-        std::vector<std::vector<sf::Color>> threadPixels(numThreads);
-        std::vector<std::vector<int>> threadRows(numThreads);
-        std::vector<std::vector<int>> threadCols(numThreads);
-        
-        for (int t = 0; t < numThreads; ++t) {
-            // Pre-allocate memory for thread-local buffers
-            threadPixels[t].reserve(width * height / numThreads);
-            threadRows[t].reserve(width * height / numThreads);
-            threadCols[t].reserve(width * height / numThreads);
-            
-            threads.emplace_back([&, t]() {
-                int row;
-                while ((row = nextRow.fetch_add(1)) < height) {
-                    for (int x = 0; x < width; ++x) {
-                        Vec3 pixelColor(0, 0, 0);
-                        
-                        // Supersampling
-                        for (int s = 0; s < samplesPerPixel; ++s) {
-                            float u = (x + (s % 2) * 0.5f) / float(width);
-                            float v = (row + (s / 2) * 0.5f) / float(height);
-                            
-                            Ray ray = camera.getRay(u, v);
-                            pixelColor = pixelColor + trace(ray, scene, maxBounces);
-                        }
-                        
-                        // Average samples
-                        pixelColor = pixelColor / float(samplesPerPixel);
-                        
-                        // Store pixel data in thread-local buffer
-                        threadPixels[t].push_back(toColor(pixelColor, exposure));
-                        threadRows[t].push_back(row);
-                        threadCols[t].push_back(x);
-                    }
+        beginFrame(camera);
+        
+        std::vector<int> tiles(tilesX * tilesY);
+        for (int i = 0; i < tilesX * tilesY; ++i) {
+            tiles[i] = i;
+        }
+        renderTiles(scene, camera, tiles);
+        
+        pendingChanges.clear();
+        lastCamera = CameraState(camera);
+        lastLightingRevision = scene.getLightingRevision();
+        historyValid = true;
+        
+        denoise();
+        tonemap();
+    }
+    
+    // Re-render only the tiles touched by objects that moved since the last
+    // frame. Falls back to a full render when the camera or settings changed.
+    // Light and material edits relight the remaining tiles from the deferred
+    // cache, or force a full render when the cache can't absorb them.
+    void renderIncremental(const Scene& scene, const Camera& camera) {
+        const bool lightingChanged = scene.getLightingRevision() != lastLightingRevision;
+        if (!historyValid || !(lastCamera == CameraState(camera)) ||
+            (lightingChanged && !canRelightLights(scene))) {
+            render(scene, camera);
+            return;
+        }
+        if (pendingChanges.empty()) {
+            if (lightingChanged) {
+                relight(scene, camera);
+            }
+            return;
+        }
+        
+        beginFrame(camera);
+        
+        std::vector<uint8_t> dirty(tilesX * tilesY, 0);
+        for (const auto& change : pendingChanges) {
+            markDirty(change.before, scene, camera, dirty);
+            markDirty(change.after, scene, camera, dirty);
+        }
+        pendingChanges.clear();
+        
+        // Mirrors may show the moved objects anywhere, so their tiles always rerun
+        std::vector<int> tiles;
+        for (int i = 0; i < tilesX * tilesY; ++i) {
+            if (dirty[i] || tileReflective[i]) {
+                tiles.push_back(i);
+            }
+        }
+        
+        renderTiles(scene, camera, tiles);
+        
+        if (lightingChanged) {
+            std::vector<uint8_t> rendered(tilesX * tilesY, 0);
+            for (int tile : tiles) {
+                rendered[tile] = 1;
+            }
+            std::vector<int> clean;
+            for (int i = 0; i < tilesX * tilesY; ++i) {
+                if (!rendered[i]) {
+                    clean.push_back(i);
                 }
+            }
+            parallelFor(static_cast<int>(clean.size()), [&](int i) {
+                tileReflective[clean[i]] = lightingPass(scene, camera, clean[i], true);
             });
+            lastLightingRevision = scene.getLightingRevision();
         }
         
-        for (auto& thread : threads) {
-            thread.join();
+        denoise();
+        tonemap();
+    }
+    
+    // Rebuild the image after changes to exposure, tone curve, sky, ambient
+    // light or light color/intensity, reusing the last deferred frame's
+    // G-buffer, ambient occlusion, shadow visibility and per-light terms:
+    // pixels without mirror bounces are a weighted sum of cached terms, with
+    // no marching at all. Anything that can move a hit or a shadow (camera,
+    // objects, light positions, settings) falls back to render().
+    void relight(const Scene& scene, const Camera& camera) {
+        if (!canRelight(scene, camera)) {
+            render(scene, camera);
+            return;
         }
         
-        // Combine all thread-local buffers into the final image
-        for (int t = 0; t < numThreads; ++t) {
-            for (size_t i = 0; i < threadPixels[t].size(); ++i) {
-                image.setPixel(threadCols[t][i], threadRows[t][i], threadPixels[t][i]);
-            }
+        beginFrame(camera);
+        parallelFor(tilesX * tilesY, [&](int tile) {
+            tileReflective[tile] = lightingPass(scene, camera, tile, true);
+        });
+        lastLightingRevision = scene.getLightingRevision();
+        historyValid = true;
+        
+        denoise();
+        tonemap();
+    }
+    
+    // Queue an object move for the next renderIncremental; hook up with
+    // scene.addChangeListener
+    void invalidate(const ObjectChange& change) {
+        pendingChanges.push_back(change);
+        
+        // Cached occlusion near the old and new place is out of date
+        aoCache.invalidate(change.before);
+        aoCache.invalidate(change.after);
+    }
+    
+    // Re-run exposure, tone curve and sRGB encoding over the HDR buffer.
+    // Cheap enough to call on its own after setExposure/setToneMapper.
+    void tonemap() {
+        // The uploader may still be reading this staging buffer from two frames ago
+        {
+            std::unique_lock<std::mutex> lock(uploadMutex);
+            uploadDone.wait(lock, [&] { return !stagingBusy[stagingIndex]; });
+        }
+        
+        // Exported frames are written into the shared slot as rows are encoded
+        uint8_t* shared = frameExport ? frameExport->beginWrite() : nullptr;
+        switch (toneMapper) {
+            case ToneMapper::Reinhard: tonemapPass<ToneMapper::Reinhard>(shared); break;
+            case ToneMapper::ACES:     tonemapPass<ToneMapper::ACES>(shared); break;
+            default:                   tonemapPass<ToneMapper::Clamp>(shared); break;
+        }
+        if (frameExport) {
+            frameExport->endWrite(exposure);
         }
         
-        textureNeedsUpdate = true;
+        latestStaging = stagingIndex;
+        stagingIndex ^= 1;
+        imageNeedsUpdate = true;
+        
+        if (uploader.joinable()) {
+            submitUpload(latestStaging);
+        }
     }
     
     const sf::Image& getImage() const { 
+        if (imageNeedsUpdate) {
+            image.create(width, height, staging[latestStaging].data());
+            imageNeedsUpdate = false;
+        }
         return image; 
     }
     
+    // RGBA8 pixels of the latest tonemapped frame, valid until the next
+    // tonemap; copy them out (e.g. FrameWriter::submit) before rendering again
+    const uint8_t* getPixels() const { return staging[latestStaging].data(); }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    
+    // Bytes of per-pixel state a render of `scene` with the current settings
+    // holds: HDR, staging and image buffers, AO, denoiser and deferred
+    // buffers. The camera's ray table is shared and not counted.
+    size_t getFrameBytes(const Scene& scene) const {
+        const size_t pixels = size_t(width) * height;
+        size_t bytes = pixels * (sizeof(Vec3) + 3 * 4);  // HDR, two staging buffers, image
+        bytes += size_t(aoWidth) * aoHeight * (2 * sizeof(float) + sizeof(Vec3)) + aoCache.bytes();
+        if (denoiseEnabled) {
+            bytes += pixels * (sizeof(DenoiseGuide) + 2 * sizeof(Vec3) + sizeof(float));
+        }
+        if (deferred) {
+            const size_t samples = pixels * samplesPerPixel;
+            const size_t lightCount = scene.getLights().size();
+            bytes += samples * (sizeof(GBufferSample) + std::max<size_t>(1, (lightCount + 63) / 64) * sizeof(uint64_t) +
+                                termLightCount(scene) * sizeof(Vec3));
+        }
+        return bytes;
+    }
+    
+    // Latest frame whose upload has completed. Uploads run on a background
+    // thread into textures allocated by the first call, so render and present
+    // overlap; the returned texture can change between calls, so fetch it
+    // every frame.
     sf::Texture& getTexture() {
-        if (textureNeedsUpdate) {
-            texture.loadFromImage(image);
-            textureNeedsUpdate = false;
+        if (!uploader.joinable()) {
+            // First call starts presentation. Textures need a GL context, so
+            // they are created here rather than in the constructor and a
+            // renderer that is never presented (sequence slots, calibration)
+            // never touches GL.
+            for (auto& texture : textures) {
+                texture.create(width, height);
+            }
+            uploader = std::thread([this] { uploadLoop(); });
+            submitUpload(latestStaging);
         }
-        return texture;
+        
+        if (readyTexture.load(std::memory_order_acquire) & freshBit) {
+            frontTexture = readyTexture.exchange(frontTexture, std::memory_order_acq_rel) & ~freshBit;
+        }
+        return textures[frontTexture];
     }
     
     void setExposure(float value) { exposure = value; }
-    void setMaxBounces(int bounces) { maxBounces = bounces; }
-    void setSamplesPerPixel(int samples) { samplesPerPixel = samples; }
+    float getExposure() const { return exposure; }
+    
+    // Publish every tonemapped frame to a POSIX shared-memory ring of the
+    // given slot count (see SharedFrameReader); an empty name stops exporting.
+    // Throws std::runtime_error if the ring cannot be created.
+    void setFrameExport(const std::string& name, int slots = 3) {
+        frameExport.reset();
+        if (!name.empty()) {
+            frameExport = std::make_unique<SharedFrameRing>(name, width, height, slots);
+        }
+    }
+    bool isExportingFrames() const { return frameExport != nullptr; }
+    void setToneMapper(ToneMapper curve) { toneMapper = curve; }
+    const PixelBuffer<Vec3>& getHdrBuffer() const { return hdrBuffer; }
+    void setMaxBounces(int bounces) {
+        maxBounces = bounces;
+        invalidateHistory();
+    }
+    
+    // Bounce rays whose accumulated weight falls below minWeight are dropped.
+    // With roulette enabled, rays under rouletteWeight survive with
+    // probability weight / rouletteWeight and are scaled up to stay unbiased.
+    void setBounceTermination(float minWeight, bool roulette = false, float rouletteWeight = 0.25f) {
+        minThroughput = minWeight;
+        russianRoulette = roulette;
+        rouletteThreshold = rouletteWeight;
+        invalidateHistory();
+    }
+    
+    // Cap on reflection rays per frame; 0 means unlimited
+    void setReflectionBudget(int raysPerFrame) {
+        reflectionBudget = raysPerFrame;
+        invalidateHistory();
+    }
+    
+    // SDF ambient occlusion on the ambient term. At half resolution it is
+    // computed in a prepass and bilaterally upsampled for primary hits;
+    // cached values are reused across frames until an object moves.
+    void setAmbientOcclusion(bool enabled, bool halfResolution = true, bool cached = true) {
+        aoEnabled = enabled;
+        aoHalfResolution = halfResolution;
+        aoCacheEnabled = cached;
+        aoCache.clear();
+        invalidateHistory();
+    }
+    
+    // Deferred shading: the primary march only fills a G-buffer of depth,
+    // octahedral normal and material ID; shadow rays and lighting then run
+    // as separate passes over it. Reflections are still traced per pixel.
+    void setDeferred(bool enabled) {
+        deferred = enabled;
+        invalidateHistory();
+    }
+    bool isDeferred() const { return deferred; }
+    
+    // Primary rays of each tile march only the objects whose bounds project
+    // onto it; lists are rebuilt in parallel every frame
+    void setTileCulling(bool enabled) { tileCulling = enabled; }
+    bool isTileCulling() const { return tileCulling; }
+    
+    // On multi-socket machines, pin workers to their NUMA node and give each
+    // node a fixed share of every pass (see parallelFor). On by default there
+    // and always off with a single node.
+    void setNumaScheduling(bool enabled) { numaScheduling = enabled && NumaTopology::get().isNuma(); }
+    bool isNumaScheduling() const { return numaScheduling; }
+    int getNumaNodeCount() const { return static_cast<int>(NumaTopology::get().nodes.size()); }
+    
+    // Worker threads per pass; 0 uses every hardware thread
+    void setThreadCount(int threads) { threadCount = std::max(threads, 0); }
+    int getThreadCount() const {
+        return threadCount > 0 ? threadCount : static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    }
+    
+    // Edge length in pixels of the tiles that are scheduled, culled and
+    // re-rendered as a unit
+    void setTileSize(int size) {
+        tileSize = std::max(size, 4);
+        tilesX = (width + tileSize - 1) / tileSize;
+        tilesY = (height + tileSize - 1) / tileSize;
+        tileReflective.assign(tilesX * tilesY, 0);
+        invalidateHistory();
+    }
+    int getTileSize() const { return tileSize; }
+    
+    // Post-process for low sample counts, guided by each pixel's primary
+    // hit: pixels on a depth, normal or material edge are blended with
+    // their neighbours to anti-alias it, then `iterations` a-trous passes
+    // smooth sampling noise (light sampling, roulette) without crossing
+    // edges. The HDR buffer keeps the raw image; tone mapping reads the
+    // filtered copy.
+    void setDenoise(bool enabled, int iterations = 3) {
+        denoiseEnabled = enabled;
+        denoiseIterations = iterations;
+        historyValid = false;
+        denoised.clear();
+    }
+    bool isDenoising() const { return denoiseEnabled; }
+    
+    const RenderStats& getStats() const { return stats; }
+    void setSamplesPerPixel(int samples) {
+        samplesPerPixel = samples;
+        invalidateHistory();
+    }
     int getSamplesPerPixel() const { return samplesPerPixel; }
     void setSkyColors(const Vec3& horizon, const Vec3& zenith) {
         skyHorizon = horizon;
         skyZenith = zenith;
+        historyValid = false;
     }
     void setGroundColors(const Vec3& horizon, const Vec3& nadir) {
         groundHorizon = horizon;
         groundNadir = nadir;
+        historyValid = false;
     }
     
 private:
+    // Pose and projection a frame was rendered with
+    struct CameraState {
+        Vec3 position, forward, right, up;
+        float fov = 0.0f;
+        float aspect = 0.0f;
+        
+        CameraState() = default;
+        explicit CameraState(const Camera& camera)
+            : position(camera.getPosition()), forward(camera.getForward()),
+              right(camera.getRight()), up(camera.getUp()),
+              fov(camera.getFOV()), aspect(camera.getAspectRatio()) {}
+        
+        bool operator==(const CameraState&) const = default;
+    };
+    
+    // Run fn(i) for i in [0, count) on the worker pool
+    template <typename Fn>
+    void parallelFor(int count, Fn&& fn) const {
+        WorkerPool& pool = workers();
+        if (pool.getNodeCount() > 1) {
+            numaParallelFor(pool, count, fn);
+            return;
+        }
+        
+        std::atomic<int> next(0);
+        pool.run([&](int) {
+            int i;
+            while ((i = next.fetch_add(1)) < count) {
+                fn(i);
+            }
+        });
+    }
+    
+    // Each node owns a contiguous share of [0, count) sized by its CPU
+    // count. Row and tile passes split the image the same way, so a node
+    // keeps revisiting the rows whose pages it first touched. Workers run
+    // pinned to their node and only take indices from other nodes' shares
+    // once their own is exhausted.
+    template <typename Fn>
+    void numaParallelFor(WorkerPool& pool, int count, Fn& fn) const {
+        struct alignas(64) Share {
+            std::atomic<int> next{0};
+            int end = 0;
+        };
+        
+        const NumaTopology& topology = NumaTopology::get();
+        const int nodeCount = pool.getNodeCount();
+        size_t totalCpus = 0;
+        for (const auto& cpus : topology.nodes) {
+            totalCpus += cpus.size();
+        }
+        std::vector<Share> shares(nodeCount);
+        size_t cpusBefore = 0;
+        for (int n = 0; n < nodeCount; ++n) {
+            shares[n].next.store(static_cast<int>(int64_t(count) * cpusBefore / totalCpus), std::memory_order_relaxed);
+            cpusBefore += topology.nodes[n].size();
+            shares[n].end = static_cast<int>(int64_t(count) * cpusBefore / totalCpus);
+        }
+        
+        pool.run([&](int n) {
+            for (int k = 0; k < nodeCount; ++k) {
+                Share& share = shares[(n + k) % nodeCount];
+                int i;
+                while ((i = share.next.fetch_add(1, std::memory_order_relaxed)) < share.end) {
+                    fn(i);
+                }
+            }
+        });
+    }
+    
+    // The pool for the current thread count and NUMA mode, rebuilt when
+    // either has changed since the last pass. With NUMA scheduling a thread
+    // count set by setThreadCount is spread over the nodes by CPU count.
+    WorkerPool& workers() const {
+        const NumaTopology& topology = NumaTopology::get();
+        std::vector<int> threadsPerNode;
+        if (numaScheduling) {
+            size_t totalCpus = 0;
+            for (const auto& cpus : topology.nodes) {
+                totalCpus += cpus.size();
+            }
+            for (const auto& cpus : topology.nodes) {
+                threadsPerNode.push_back(threadCount > 0
+                    ? static_cast<int>(std::max<size_t>(1, (cpus.size() * threadCount + totalCpus / 2) / totalCpus))
+                    : static_cast<int>(cpus.size()));
+            }
+        } else {
+            threadsPerNode.push_back(getThreadCount());
+        }
+        
+        if (!pool || !pool->matches(threadsPerNode, numaScheduling)) {
+            pool.reset();
+            pool = std::make_unique<WorkerPool>(std::move(threadsPerNode), numaScheduling);
+        }
+        return *pool;
+    }
+    
+    // Initialize a per-pixel buffer in image-row slices, one per task, so
+    // each slice is first touched by a worker on the node that renders it
+    template <typename T>
+    void firstTouch(PixelBuffer<T>& buffer, const T& value) const {
+        const size_t size = buffer.size();
+        parallelFor(height, [&](int row) {
+            std::fill(buffer.data() + size * row / height, buffer.data() + size * (row + 1) / height, value);
+        });
+    }
+    
+    // Resize a per-pixel buffer, refilling it through firstTouch when the
+    // size changes; unchanged buffers keep their contents
+    template <typename T>
+    void resizePixels(PixelBuffer<T>& buffer, size_t size, const T& value = T()) const {
+        if (buffer.size() != size) {
+            buffer.resize(size);
+            firstTouch(buffer, value);
+        }
+    }
+    
+    // Primary-hit features of a pixel that steer the denoiser
+    struct DenoiseGuide {
+        float depth = std::numeric_limits<float>::infinity(); // Primary hit distance; infinite for sky
+        Vec3 normal{0.0f, 0.0f, 0.0f};
+        MaterialId material = 0;
+    };
+    
+    // Per-tile state threaded through trace
+    struct TraceContext {
+        uint32_t rng = 0;
+        bool reflected = false;
+        int x = 0;
+        int y = 0;
+        const Scene::ObjectList* objects = nullptr; // Culled list for primary rays, if any
+        DenoiseGuide* guide = nullptr;              // Filled by the next primary hit, then cleared
+        RenderStats stats;
+    };
+    
+    // Lock-free world-space cache of occlusion values keyed by position and
+    // normal quantized at about one pixel's footprint; colliding entries
+    // simply overwrite each other. Each entry's tag also mixes in the
+    // generation of the coarse region around its position, so moving an
+    // object retires only the entries near it (see invalidate).
+    class AOCache {
+    public:
+        AOCache() : entries(size), regions(regionCount) {}
+        
+        bool lookup(uint64_t key, const Vec3& position, float& value) const {
+            uint64_t entry = entries[key & (size - 1)].load(std::memory_order_relaxed);
+            if ((entry >> 32) != tag(key, position)) {
+                return false;
+            }
+            value = std::bit_cast<float>(static_cast<uint32_t>(entry));
+            return true;
+        }
+        
+        void store(uint64_t key, const Vec3& position, float value) {
+            uint64_t entry = (uint64_t(tag(key, position)) << 32) | std::bit_cast<uint32_t>(value);
+            entries[key & (size - 1)].store(entry, std::memory_order_relaxed);
+        }
+        
+        size_t bytes() const {
+            return entries.size() * sizeof(entries[0]) + regions.size() * sizeof(regions[0]);
+        }
+        
+        void clear() {
+            for (auto& entry : entries) {
+                entry.store(0, std::memory_order_relaxed);
+            }
+        }
+        
+        // Retire the entries of every point whose occlusion geometry inside
+        // `bounds` can change: those within twice the AO reach of it
+        void invalidate(const Bounds& bounds) {
+            if (bounds.isEmpty()) {
+                return;
+            }
+            const Bounds padded = bounds.expand(2.0f * Scene::aoMaxDistance);
+            const float cells = padded.isInfinite() ? float(regionCount) :
+                (std::floor(padded.max.x / regionSize) - std::floor(padded.min.x / regionSize) + 1.0f) *
+                (std::floor(padded.max.y / regionSize) - std::floor(padded.min.y / regionSize) + 1.0f) *
+                (std::floor(padded.max.z / regionSize) - std::floor(padded.min.z / regionSize) + 1.0f);
+            if (cells >= float(regionCount)) {
+                globalGeneration++;
+                return;
+            }
+            for (int64_t x = cell(padded.min.x); x <= cell(padded.max.x); ++x) {
+                for (int64_t y = cell(padded.min.y); y <= cell(padded.max.y); ++y) {
+                    for (int64_t z = cell(padded.min.z); z <= cell(padded.max.z); ++z) {
+                        regions[region(x, y, z)].fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+            }
+        }
+        
+        // cellSize is the world-space edge of one pixel at the point; it is
+        // rounded down to a power of two so nearby views share cells
+        static uint64_t key(const Vec3& position, const Vec3& normal, float cellSize) {
+            const int level = std::ilogb(std::max(cellSize, 1e-4f));
+            const float cell = std::ldexp(1.0f, level);
+            auto quantize = [](float v, float step) {
+                return static_cast<uint64_t>(static_cast<int64_t>(std::floor(v / step)));
+            };
+            uint64_t h = 0xcbf29ce484222325ull;
+            for (uint64_t v : {quantize(position.x, cell), quantize(position.y, cell), quantize(position.z, cell),
+                               quantize(normal.x, 0.25f), quantize(normal.y, 0.25f), quantize(normal.z, 0.25f),
+                               static_cast<uint64_t>(level)}) {
+                h = (h ^ v) * 0x100000001b3ull;
+                h ^= h >> 29;
+            }
+            return h;
+        }
+        
+    private:
+        static constexpr size_t size = size_t(1) << 18;
+        static constexpr size_t regionCount = size_t(1) << 12;
+        static constexpr float regionSize = 0.5f;
+        
+        static int64_t cell(float v) { return static_cast<int64_t>(std::floor(v / regionSize)); }
+        
+        static size_t region(int64_t x, int64_t y, int64_t z) {
+            uint64_t h = uint64_t(x) * 0x9e3779b97f4a7c15ull ^ uint64_t(y) * 0xc2b2ae3d27d4eb4full ^ uint64_t(z) * 0x165667b19e3779f9ull;
+            return static_cast<size_t>(h >> 52) & (regionCount - 1);
+        }
+        
+        // Never zero, so cleared entries never match
+        uint32_t tag(uint64_t key, const Vec3& position) const {
+            const uint64_t generation = (uint64_t(globalGeneration) << 32) |
+                regions[region(cell(position.x), cell(position.y), cell(position.z))].load(std::memory_order_relaxed);
+            return static_cast<uint32_t>((key ^ generation * 0x9e3779b97f4a7c15ull) >> 32) | 1u;
+        }
+        
+        std::vector<std::atomic<uint64_t>> entries;
+        std::vector<std::atomic<uint32_t>> regions;  // Generation per hashed region cell
+        uint32_t globalGeneration = 0;               // For moves too large to track by region
+    };
+    
+    void beginFrame(const Camera& camera) {
+        stats = RenderStats();
+        reflectionBudgetLeft = reflectionBudget;
+        aoEye = camera.getPosition();
+        aoPixelAngle = camera.getPixelAngle(height);
+        
+        // Single-threaded here so the tile workers only read the ray table
+        camera.prepareRays(width, height, samplesPerPixel);
+    }
+    
+    // Multi-threaded rendering of the given tiles straight into the float HDR buffer
+    void renderTiles(const Scene& scene, const Camera& camera, const std::vector<int>& tiles) {
+        if (aoEnabled && aoHalfResolution) {
+            aoPrepass(scene, camera, tiles);
+        }
+        
+        const int count = static_cast<int>(tiles.size());
+        if (denoiseEnabled) {
+            resizePixels(guides, size_t(width) * height);
+        }
+        if (tileCulling) {
+            cullTiles(scene, camera, tiles);
+        }
+        
+        if (!deferred) {
+            parallelFor(count, [&](int i) {
+                tileReflective[tiles[i]] = renderTile(scene, camera, tiles[i]);
+            });
+            return;
+        }
+        
+        const size_t samples = size_t(width) * height * samplesPerPixel;
+        const size_t lightCount = scene.getLights().size();
+        resizePixels(gBuffer, samples);
+        shadowWords = std::max<int>(1, static_cast<int>((lightCount + 63) / 64));
+        resizePixels(shadowBits, samples * shadowWords);
+        
+        termLights = termLightCount(scene);
+        resizePixels(lightTerms, samples * termLights);
+        
+        parallelFor(count, [&](int i) { geometryPass(scene, camera, tiles[i]); });
+        parallelFor(count, [&](int i) { shadowPass(scene, camera, tiles[i]); });
+        parallelFor(count, [&](int i) {
+            tileReflective[tiles[i]] = lightingPass(scene, camera, tiles[i], false);
+        });
+        
+        relightLights = scene.getLights();
+        relightLightSamples = scene.getLightSamples();
+        relightValid = true;
+    }
+    
+    // Per-light terms only pay off for a handful of fixed lights
+    int termLightCount(const Scene& scene) const {
+        const size_t lightCount = scene.getLights().size();
+        return lightCount <= maxTermLights && scene.getLightSamples() <= 0 ? static_cast<int>(lightCount) : 0;
+    }
+    
+    void invalidateHistory() {
+        historyValid = false;
+        relightValid = false;
+    }
+    
+    // Whether the last deferred frame still holds every hit and shadow for
+    // this camera and scene
+    bool canRelight(const Scene& scene, const Camera& camera) const {
+        return pendingChanges.empty() && lastCamera == CameraState(camera) && canRelightLights(scene);
+    }
+    
+    // Whether the cached hits and shadows still hold for the scene's lights,
+    // whatever happened to the geometry
+    bool canRelightLights(const Scene& scene) const {
+        if (!deferred || !relightValid) {
+            return false;
+        }
+        const auto& lights = scene.getLights();
+        if (lights.size() != relightLights.size() || scene.getLightSamples() != relightLightSamples) {
+            return false;
+        }
+        for (size_t i = 0; i < lights.size(); ++i) {
+            const auto& light = lights[i];
+            const auto& before = relightLights[i];
+            if (!(light.position == before.position) || light.range != before.range) {
+                return false;
+            }
+            // Sampled lights are picked by their power, so the recorded shadow
+            // rays only hold while colors and intensities stay put
+            if (relightLightSamples > 0 && (!(light.color == before.color) || light.intensity != before.intensity)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    PixelRect tileRect(int tile) const {
+        const int x0 = (tile % tilesX) * tileSize;
+        const int y0 = (tile / tilesX) * tileSize;
+        return PixelRect{x0, y0, std::min(x0 + tileSize, width), std::min(y0 + tileSize, height)};
+    }
+    
+    void addWorkTime(std::chrono::steady_clock::time_point start) {
+        RenderStats pass;
+        pass.workSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats += pass;
+    }
+    
+    // Deferred: march the primary rays of a tile into the G-buffer
+    void geometryPass(const Scene& scene, const Camera& camera, int tile) {
+        auto start = std::chrono::steady_clock::now();
+        const PixelRect rect = tileRect(tile);
+        thread_local std::vector<Ray> rays;
+        camera.getRays(rect, rays);
+        const Ray* ray = rays.data();
+        
+        for (int y = rect.y0; y < rect.y1; ++y) {
+            for (int x = rect.x0; x < rect.x1; ++x) {
+                GBufferSample* sample = &gBuffer[size_t(y * width + x) * samplesPerPixel];
+                for (int s = 0; s < samplesPerPixel; ++s, ++ray, ++sample) {
+                    Hit hit;
+                    if (tileCulling ? scene.march(*ray, hit, tileObjects[tile]) : scene.march(*ray, hit)) {
+                        const Vec3 normal = scene.normal(hit);
+                        sample->depth = hit.distance;
+                        sample->normal = encodeOctahedral(normal);
+                        sample->material = hit.material;
+                        if (denoiseEnabled && s == 0) {
+                            guides[y * width + x] = DenoiseGuide{hit.distance, normal, hit.material};
+                        }
+                    } else {
+                        sample->depth = std::numeric_limits<float>::infinity();
+                        if (denoiseEnabled && s == 0) {
+                            guides[y * width + x] = DenoiseGuide();
+                        }
+                    }
+                }
+            }
+        }
+        
+        addWorkTime(start);
+    }
+    
+    // Deferred: cast every shadow ray the lighting pass will need and keep
+    // one visibility bit per light and sample
+    void shadowPass(const Scene& scene, const Camera& camera, int tile) {
+        auto start = std::chrono::steady_clock::now();
+        const PixelRect rect = tileRect(tile);
+        thread_local std::vector<Ray> rays;
+        camera.getRays(rect, rays);
+        const Ray* ray = rays.data();
+        
+        for (int y = rect.y0; y < rect.y1; ++y) {
+            for (int x = rect.x0; x < rect.x1; ++x) {
+                for (int s = 0; s < samplesPerPixel; ++s, ++ray) {
+                    const size_t index = size_t(y * width + x) * samplesPerPixel + s;
+                    uint64_t* bits = &shadowBits[index * shadowWords];
+                    std::fill(bits, bits + shadowWords, 0);
+                    
+                    Hit hit;
+                    Vec3 normal;
+                    if (!unpackSample(*ray, index, hit, normal)) {
+                        continue;
+                    }
+                    scene.forEachShadowRay(hit, normal, [&](uint32_t light, const Ray& shadowRay, float dist) {
+                        if (!scene.occluded(shadowRay, dist)) {
+                            bits[light / 64] |= uint64_t(1) << (light % 64);
+                        }
+                    });
+                }
+            }
+        }
+        
+        addWorkTime(start);
+    }
+    
+    // Deferred: shade a tile from the G-buffer and shadow bits; returns
+    // whether any pixel in it bounced off a mirror. With reuse, occlusion
+    // and per-light terms come from the last pass instead of being computed.
+    bool lightingPass(const Scene& scene, const Camera& camera, int tile, bool reuse) {
+        const PixelRect rect = tileRect(tile);
+        TraceContext context;
+        auto start = std::chrono::steady_clock::now();
+        
+        thread_local std::vector<Ray> rays;
+        camera.getRays(rect, rays);
+        const Ray* ray = rays.data();
+        
+        for (int y = rect.y0; y < rect.y1; ++y) {
+            for (int x = rect.x0; x < rect.x1; ++x) {
+                Vec3 pixelColor(0, 0, 0);
+                context.x = x;
+                context.y = y;
+                context.rng = hash(static_cast<uint32_t>(y * width + x));
+                
+                for (int s = 0; s < samplesPerPixel; ++s, ++ray) {
+                    const size_t index = size_t(y * width + x) * samplesPerPixel + s;
+                    pixelColor = pixelColor + shadeSample(scene, *ray, index, reuse, context);
+                }
+                
+                hdrBuffer[y * width + x] = pixelColor / float(samplesPerPixel);
+            }
+        }
+        
+        context.stats.workSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats += context.stats;
+        
+        return context.reflected;
+    }
+    
+    Vec3 shadeSample(const Scene& scene, const Ray& ray, size_t index, bool reuse, TraceContext& context) {
+        Hit hit;
+        Vec3 normal;
+        if (!unpackSample(ray, index, hit, normal)) {
+            return renderSky(ray);
+        }
+        
+        GBufferSample& sample = gBuffer[index];
+        Vec3* terms = termLights > 0 ? &lightTerms[index * termLights] : nullptr;
+        Vec3 color;
+        
+        if (reuse && terms && !sample.bounced) {
+            // Direct lighting only: re-weight the cached terms
+            color = scene.baseLighting(hit.material, sample.occlusion);
+            const auto& lights = scene.getLights();
+            for (int i = 0; i < termLights; ++i) {
+                color = color + terms[i] * lights[i].color * lights[i].intensity;
+            }
+            return color;
+        }
+        
+        if (!reuse) {
+            sample.occlusion = aoEnabled ? occlusionAt(scene, hit, normal, maxBounces, context) : 1.0f;
+        }
+        
+        const uint64_t* bits = &shadowBits[index * shadowWords];
+        auto visible = [bits](uint32_t light, const Ray&, float) {
+            return (bits[light / 64] >> (light % 64)) & 1;
+        };
+        
+        // Same sum as Scene::calculateLighting, keeping each light's term
+        if (terms) {
+            std::fill(terms, terms + termLights, Vec3(0, 0, 0));
+        }
+        color = scene.baseLighting(hit.material, sample.occlusion);
+        scene.forEachLightTerm(hit, normal, ray, visible, [&](uint32_t light, const Vec3& term) {
+            const auto& source = scene.getLights()[light];
+            color = color + term * source.color * source.intensity;
+            if (terms) {
+                terms[light] = terms[light] + term;
+            }
+        });
+        
+        bool bounced = false;
+        color = color + reflection(ray, hit, normal, scene, maxBounces, Vec3(1, 1, 1), context, bounced);
+        sample.bounced = bounced;
+        return color;
+    }
+    
+    // Rebuild the primary hit of a G-buffer sample; false for sky
+    bool unpackSample(const Ray& ray, size_t index, Hit& hit, Vec3& normal) const {
+        const GBufferSample& sample = gBuffer[index];
+        if (!std::isfinite(sample.depth)) {
+            return false;
+        }
+        hit.distance = sample.depth;
+        hit.position = ray.at(sample.depth);
+        hit.material = sample.material;
+        normal = decodeOctahedral(sample.normal);
+        return true;
+    }
+    
+    // Trace every pixel of one tile into the HDR buffer; returns whether any
+    // ray in it bounced off a mirror
+    bool renderTile(const Scene& scene, const Camera& camera, int tile) {
+        const PixelRect rect = tileRect(tile);
+        TraceContext context;
+        context.objects = tileCulling ? &tileObjects[tile] : nullptr;
+        auto start = std::chrono::steady_clock::now();
+        
+        thread_local std::vector<Ray> rays;
+        camera.getRays(rect, rays);
+        const Ray* ray = rays.data();
+        
+        for (int y = rect.y0; y < rect.y1; ++y) {
+            for (int x = rect.x0; x < rect.x1; ++x) {
+                Vec3 pixelColor(0, 0, 0);
+                context.x = x;
+                context.y = y;
+                
+                // Seed per pixel so re-rendered tiles reproduce the same image
+                context.rng = hash(static_cast<uint32_t>(y * width + x));
+                
+                // The first sample's primary hit guides the denoiser
+                context.guide = denoiseEnabled ? &guides[y * width + x] : nullptr;
+                
+                // Supersampling
+                for (int s = 0; s < samplesPerPixel; ++s) {
+                    pixelColor = pixelColor + trace(*ray++, scene, maxBounces, Vec3(1, 1, 1), context);
+                }
+                
+                // Average samples
+                hdrBuffer[y * width + x] = pixelColor / float(samplesPerPixel);
+            }
+        }
+        
+        context.stats.workSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats += context.stats;
+        
+        return context.reflected;
+    }
+    
+    float computeAO(const Scene& scene, const Vec3& position, const Vec3& normal, TraceContext& context) {
+        auto start = std::chrono::steady_clock::now();
+        float occlusion;
+        uint64_t key = AOCache::key(position, normal, (position - aoEye).length() * aoPixelAngle);
+        
+        if (aoCacheEnabled && aoCache.lookup(key, position, occlusion)) {
+            context.stats.aoCacheHits++;
+        } else {
+            occlusion = scene.ambientOcclusion(position, normal);
+            context.stats.aoSamples++;
+            if (aoCacheEnabled) {
+                aoCache.store(key, position, occlusion);
+            }
+        }
+        
+        context.stats.aoSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return occlusion;
+    }
+    
+    // March primary rays at half resolution over the given tiles (plus a
+    // one-sample border for upsampling) and store occlusion, depth and normal
+    void aoPrepass(const Scene& scene, const Camera& camera, const std::vector<int>& tiles) {
+        std::vector<uint8_t> mask(aoWidth * aoHeight, 0);
+        for (int tile : tiles) {
+            const int x0 = (tile % tilesX) * tileSize;
+            const int y0 = (tile / tilesX) * tileSize;
+            const int jx0 = std::max(x0 / 2 - 1, 0);
+            const int jy0 = std::max(y0 / 2 - 1, 0);
+            const int jx1 = std::min((x0 + tileSize) / 2 + 1, aoWidth);
+            const int jy1 = std::min((y0 + tileSize) / 2 + 1, aoHeight);
+            for (int jy = jy0; jy < jy1; ++jy) {
+                std::fill(mask.begin() + jy * aoWidth + jx0, mask.begin() + jy * aoWidth + jx1, 1);
+            }
+        }
+        
+        parallelFor(aoHeight, [&](int jy) {
+            TraceContext context;
+            auto start = std::chrono::steady_clock::now();
+            
+            for (int jx = 0; jx < aoWidth; ++jx) {
+                int i = jy * aoWidth + jx;
+                if (!mask[i]) {
+                    continue;
+                }
+                
+                // Centre of the 2x2 block of full-resolution samples
+                Ray ray = camera.getRay((2 * jx + 0.5f) / float(width), (2 * jy + 0.5f) / float(height));
+                Hit hit;
+                if (scene.march(ray, hit)) {
+                    Vec3 normal = scene.normal(hit);
+                    aoValues[i] = computeAO(scene, hit.position, normal, context);
+                    aoDepths[i] = hit.distance;
+                    aoNormals[i] = normal;
+                } else {
+                    aoValues[i] = 1.0f;
+                    aoDepths[i] = std::numeric_limits<float>::infinity();
+                }
+            }
+            
+            // The whole prepass is occlusion overhead
+            double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            context.stats.aoSeconds = elapsed;
+            context.stats.workSeconds = elapsed;
+            
+            std::lock_guard<std::mutex> lock(statsMutex);
+            stats += context.stats;
+        });
+    }
+    
+    // Bilateral upsample of the half-resolution occlusion at a primary hit:
+    // bilinear weights attenuated by depth and normal differences
+    float upsampleAO(const Scene& scene, const Hit& hit, const Vec3& normal, TraceContext& context) {
+        float fx = (context.x - 0.5f) * 0.5f;
+        float fy = (context.y - 0.5f) * 0.5f;
+        int jx = static_cast<int>(std::floor(fx));
+        int jy = static_cast<int>(std::floor(fy));
+        float tx = fx - jx;
+        float ty = fy - jy;
+        
+        float sum = 0.0f;
+        float totalWeight = 0.0f;
+        for (int dy = 0; dy <= 1; ++dy) {
+            for (int dx = 0; dx <= 1; ++dx) {
+                int sx = std::clamp(jx + dx, 0, aoWidth - 1);
+                int sy = std::clamp(jy + dy, 0, aoHeight - 1);
+                int i = sy * aoWidth + sx;
+                if (!std::isfinite(aoDepths[i])) {
+                    continue;
+                }
+                
+                float weight = (dx ? tx : 1.0f - tx) * (dy ? ty : 1.0f - ty) + 1e-3f;
+                float relDepth = std::abs(aoDepths[i] - hit.distance) / std::max(hit.distance, 1e-3f);
+                weight *= 1.0f / (1.0f + relDepth * relDepth * 2500.0f);
+                float facing = std::max(0.0f, aoNormals[i].dot(normal));
+                facing *= facing;
+                facing *= facing;
+                weight *= facing * facing;
+                
+                sum += aoValues[i] * weight;
+                totalWeight += weight;
+            }
+        }
+        
+        // No compatible neighbour (silhouettes, thin features): evaluate here
+        if (totalWeight < 1e-4f) {
+            return computeAO(scene, hit.position, normal, context);
+        }
+        return sum / totalWeight;
+    }
+    
+    static uint32_t hash(uint32_t x) {
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return x;
+    }
+    
+    // Uniform float in [0, 1)
+    static float random(TraceContext& context) {
+        context.rng = hash(context.rng + 0x9e3779b9u);
+        return (context.rng >> 8) * (1.0f / 16777216.0f);
+    }
+    
+    bool consumeReflectionBudget() {
+        return reflectionBudget <= 0 || reflectionBudgetLeft.fetch_sub(1, std::memory_order_relaxed) > 0;
+    }
+    
+    // Flag every tile that the object inside `bounds`, the shadow it casts
+    // towards any light, or with ambient occlusion on, the contact darkening
+    // it leaves on nearby surfaces, could cover on screen
+    void markDirty(const Bounds& bounds, const Scene& scene, const Camera& camera,
+                   std::vector<uint8_t>& dirty) const {
+        if (bounds.isEmpty()) {
+            return;
+        }
+        if (bounds.isInfinite()) {
+            std::fill(dirty.begin(), dirty.end(), 1);
+            return;
+        }
+        
+        // Shadow rays only matter for receivers the primary march can reach
+        const float shadowReach = 200.0f;
+        Bounds padded = bounds.expand(aoEnabled ? 2.0f * Scene::aoMaxDistance : 0.01f);
+        
+        std::vector<Vec3> points;
+        for (int i = 0; i < 8; ++i) {
+            points.push_back(camera.toView(padded.corner(i)));
+        }
+        for (const auto& light : scene.getLights()) {
+            // Ranged lights cannot cast shadows past their range
+            float reach = light.range > 0.0f ? std::min(shadowReach, light.range) : shadowReach;
+            for (int i = 0; i < 8; ++i) {
+                Vec3 corner = padded.corner(i);
+                Vec3 away = corner - light.position;
+                if (away.length() < 1e-4f) {
+                    std::fill(dirty.begin(), dirty.end(), 1);
+                    return;
+                }
+                points.push_back(camera.toView(corner + away.normalize() * reach));
+            }
+        }
+        
+        TileRange range;
+        if (!screenTiles(points, camera, range)) {
+            return;
+        }
+        for (int ty = range.y0; ty <= range.y1; ++ty) {
+            for (int tx = range.x0; tx <= range.x1; ++tx) {
+                dirty[ty * tilesX + tx] = 1;
+            }
+        }
+    }
+    
+    // Inclusive tile coordinates; x0 > x1 when empty
+    struct TileRange {
+        int x0 = 1, y0 = 1, x1 = 0, y1 = 0;
+        
+        bool contains(int tx, int ty) const { return tx >= x0 && tx <= x1 && ty >= y0 && ty <= y1; }
+    };
+    
+    // Tiles covered by the hull of some view-space points; false if it is
+    // entirely behind the camera or off screen
+    bool screenTiles(const std::vector<Vec3>& points, const Camera& camera, TileRange& range) const {
+        const float nearPlane = 0.01f;
+        
+        // Clip the hull of the points against the near plane: keep points in
+        // front, plus the crossing point of every segment that straddles it
+        std::vector<Vec3> visible;
+        for (size_t i = 0; i < points.size(); ++i) {
+            if (points[i].z >= nearPlane) {
+                visible.push_back(points[i]);
+            }
+            for (size_t j = i + 1; j < points.size(); ++j) {
+                const Vec3& a = points[i];
+                const Vec3& b = points[j];
+                if ((a.z < nearPlane) != (b.z < nearPlane)) {
+                    float s = (nearPlane - a.z) / (b.z - a.z);
+                    Vec3 p = a + (b - a) * s;
+                    visible.push_back(Vec3(p.x, p.y, nearPlane));
+                }
+            }
+        }
+        if (visible.empty()) {
+            return false;
+        }
+        
+        float minU = std::numeric_limits<float>::max(), maxU = -minU;
+        float minV = minU, maxV = -minU;
+        for (const auto& point : visible) {
+            Vec3 screen = camera.viewToScreen(point);
+            minU = std::min(minU, screen.x);
+            maxU = std::max(maxU, screen.x);
+            minV = std::min(minV, screen.y);
+            maxV = std::max(maxV, screen.y);
+        }
+        
+        if (maxU < 0.0f || minU > 1.0f || maxV < 0.0f || minV > 1.0f) {
+            return false;
+        }
+        
+        // Supersamples sit up to several pixels right of and below their
+        // pixel, so pull the range back by the largest offset, plus one pixel
+        // of margin for normal estimation
+        float offsetX = 0.0f, offsetY = 0.0f;
+        for (int s = 0; s < samplesPerPixel; ++s) {
+            float dx, dy;
+            Camera::sampleOffset(s, dx, dy);
+            offsetX = std::max(offsetX, dx);
+            offsetY = std::max(offsetY, dy);
+        }
+        auto toTile = [this](float coord, int size) {
+            return static_cast<int>(std::clamp(coord, 0.0f, float(size - 1))) / tileSize;
+        };
+        range.x0 = toTile(minU * width - offsetX - 1.0f, width);
+        range.x1 = toTile(maxU * width + 1.0f, width);
+        range.y0 = toTile(minV * height - offsetY - 1.0f, height);
+        range.y1 = toTile(maxV * height + 1.0f, height);
+        return true;
+    }
+    
+    // Per-tile object lists for primary rays: an object goes into every tile
+    // its padded bounds project onto, unbounded objects into all of them.
+    // Ranges are found per object, then lists are filled per tile, both in
+    // parallel.
+    void cullTiles(const Scene& scene, const Camera& camera, const std::vector<int>& tiles) {
+        const int objectCount = static_cast<int>(scene.getObjectCount());
+        objectTiles.resize(objectCount);
+        parallelFor(objectCount, [&](int id) {
+            Bounds bounds = scene.getBounds(id);
+            TileRange& range = objectTiles[id];
+            range = TileRange();
+            if (bounds.isInfinite()) {
+                range = TileRange{0, 0, tilesX - 1, tilesY - 1};
+            } else if (!bounds.isEmpty()) {
+                Bounds padded = bounds.expand(0.01f);
+                std::vector<Vec3> points;
+                for (int i = 0; i < 8; ++i) {
+                    points.push_back(camera.toView(padded.corner(i)));
+                }
+                screenTiles(points, camera, range);
+            }
+        });
+        
+        tileObjects.resize(tilesX * tilesY);
+        parallelFor(static_cast<int>(tiles.size()), [&](int i) {
+            const int tile = tiles[i];
+            Scene::ObjectList& list = tileObjects[tile];
+            list.clear();
+            for (int id = 0; id < objectCount; ++id) {
+                if (objectTiles[id].contains(tile % tilesX, tile / tilesX)) {
+                    scene.addToList(id, list);
+                }
+            }
+        });
+    }
+    
+    // Edge anti-aliasing, then a-trous noise filtering of the HDR buffer into
+    // denoised; see setDenoise
+    void denoise() {
+        if (!denoiseEnabled || guides.size() != hdrBuffer.size()) {
+            // Nothing filtered this frame, so tonemap must not show an older one
+            denoised.clear();
+            return;
+        }
+        resizePixels(denoised, hdrBuffer.size());
+        resizePixels(denoiseScratch, hdrBuffer.size());
+        resizePixels(luminance, hdrBuffer.size());
+        
+        parallelFor(height, [&](int y) { antialiasRow(y); });
+        for (int i = 0; i < denoiseIterations; ++i) {
+            parallelFor(height, [&](int y) {
+                for (int x = y * width; x < (y + 1) * width; ++x) {
+                    const Vec3& c = denoised[x];
+                    luminance[x] = 0.2126f * c.x + 0.7152f * c.y + 0.0722f * c.z;
+                }
+            });
+            parallelFor(height, [&](int y) { atrousRow(denoised, denoiseScratch, y, 1 << i); });
+            std::swap(denoised, denoiseScratch);
+        }
+    }
+    
+    // Whether two guides lie on the same smooth surface
+    static bool sameSurface(const DenoiseGuide& a, const DenoiseGuide& b) {
+        if (a.material != b.material || std::isfinite(a.depth) != std::isfinite(b.depth)) {
+            return false;
+        }
+        if (!std::isfinite(a.depth)) {
+            return true;
+        }
+        return std::abs(a.depth - b.depth) < 0.05f * a.depth && a.normal.dot(b.normal) > 0.9f;
+    }
+    
+    // Pixels whose 4-neighbourhood crosses a depth, normal or material edge
+    // take in a quarter of each neighbour, roughly the coverage a few
+    // supersamples would see; the rest are copied unchanged
+    void antialiasRow(int y) {
+        const int up = std::max(y - 1, 0) * width;
+        const int down = std::min(y + 1, height - 1) * width;
+        for (int x = 0; x < width; ++x) {
+            const int index = y * width + x;
+            const int left = y * width + std::max(x - 1, 0);
+            const int right = y * width + std::min(x + 1, width - 1);
+            const int neighbors[4] = {left, right, up + x, down + x};
+            
+            const DenoiseGuide& center = guides[index];
+            bool edge = false;
+            for (int n : neighbors) {
+                edge = edge || !sameSurface(center, guides[n]);
+            }
+            if (!edge) {
+                denoised[index] = hdrBuffer[index];
+                continue;
+            }
+            
+            Vec3A sum = toVec3A(hdrBuffer[index]) * Vec3A::splat(4.0f);
+            for (int n : neighbors) {
+                sum = sum + toVec3A(hdrBuffer[n]);
+            }
+            denoised[index] = toVec3(sum * Vec3A::splat(0.125f));
+        }
+    }
+    
+    // One a-trous pass: a 3x3 B-spline kernel with taps `step` pixels apart,
+    // each weighted down by depth, normal, material and luminance differences.
+    // Falloffs are linear rather than exponential to keep the pass cheap.
+    void atrousRow(const PixelBuffer<Vec3>& src, PixelBuffer<Vec3>& dst, int y, int step) const {
+        static constexpr float kernel[3] = {0.25f, 0.5f, 0.25f};
+        const float inf = std::numeric_limits<float>::infinity();
+        const int dyMin = y - step >= 0 ? -1 : 0;
+        const int dyMax = y + step < height ? 1 : 0;
+        
+        for (int x = 0; x < width; ++x) {
+            const int index = y * width + x;
+            const DenoiseGuide& center = guides[index];
+            const bool sky = center.depth == inf;
+            const float centerLum = luminance[index];
+            const float lumScale = 1.0f / (denoiseColorSigma * centerLum + 1e-3f);
+            const float depthScale = sky ? 0.0f : 1.0f / (denoiseDepthSigma * center.depth * step);
+            const int dxMin = x - step >= 0 ? -1 : 0;
+            const int dxMax = x + step < width ? 1 : 0;
+            
+            Vec3A sum = Vec3A::splat(0.0f);
+            float total = 0.0f;
+            for (int dy = dyMin; dy <= dyMax; ++dy) {
+                const int row = index + dy * step * width;
+                for (int dx = dxMin; dx <= dxMax; ++dx) {
+                    const int tapIndex = row + dx * step;
+                    const DenoiseGuide& tap = guides[tapIndex];
+                    if (tap.material != center.material || (tap.depth == inf) != sky) {
+                        continue;
+                    }
+                    
+                    // Sharp normal falloff (cos^32); sky has no normal
+                    float n = sky ? 1.0f : std::max(center.normal.dot(tap.normal), 0.0f);
+                    n *= n; n *= n; n *= n; n *= n; n *= n;
+                    
+                    float falloff = std::abs(luminance[tapIndex] - centerLum) * lumScale;
+                    if (!sky) {
+                        falloff += std::abs(tap.depth - center.depth) * depthScale;
+                    }
+                    float w = kernel[dx + 1] * kernel[dy + 1] * n * std::max(1.0f - falloff, 0.0f);
+                    
+                    sum = madd(toVec3A(src[tapIndex]), Vec3A::splat(w), sum);
+                    total += w;
+                }
+            }
+            dst[index] = total > 0.0f ? toVec3(sum * (1.0f / total)) : src[index];
+        }
+    }
+    
+    // Two passes per row: exposure, tone curve, clamp and LUT scaling run
+    // four floats at a time over the row's interleaved RGB into a scratch
+    // row, then a scalar pass gathers the sRGB bytes from the table.
+    template <ToneMapper Curve>
+    void tonemapPass(uint8_t* shared) {
+        static_assert(sizeof(Vec3) == 3 * sizeof(float), "tonemapPass reads Vec3 rows as packed floats");
+        const PixelBuffer<Vec3>& source = denoiseEnabled && !denoised.empty() ? denoised : hdrBuffer;
+        const SrgbLut& lut = SrgbLut::get();
+        
+        parallelFor(height, [&](int row) {
+            const float* src = reinterpret_cast<const float*>(&source[row * width]);
+            uint8_t* dst = &staging[stagingIndex][row * width * 4];
+            const int count = width * 3;
+            
+            thread_local std::vector<float> indices;
+            indices.resize(count);
+            const Vec4 scale = Vec4::splat(exposure);
+            const Vec4 zero = Vec4::splat(0.0f);
+            const Vec4 one = Vec4::splat(1.0f);
+            const Vec4 last = Vec4::splat(float(SrgbLut::size - 1));
+            const Vec4 half = Vec4::splat(0.5f);
+            int i = 0;
+            for (; i + 4 <= count; i += 4) {
+                Vec4 v = toneMap<Curve>(Vec4::load(src + i) * scale).max(zero).min(one);
+                madd(v, last, half).store(&indices[i]);
+            }
+            for (; i < count; ++i) {
+                indices[i] = std::clamp(toneMap<Curve>(src[i] * exposure), 0.0f, 1.0f) * (SrgbLut::size - 1) + 0.5f;
+            }
+            
+            // A NaN (0/0 in the ACES fit, a degenerate normal) survives the
+            // clamps above on some targets; it fails both compares here and
+            // encodes as black instead of indexing outside the table
+            auto encode = [&](float index) {
+                return index >= 0.0f && index < float(SrgbLut::size) ? lut[static_cast<int>(index)] : lut[0];
+            };
+            for (int x = 0; x < width; ++x) {
+                dst[x * 4 + 0] = encode(indices[x * 3 + 0]);
+                dst[x * 4 + 1] = encode(indices[x * 3 + 1]);
+                dst[x * 4 + 2] = encode(indices[x * 3 + 2]);
+            }
+            if (shared) {
+                std::memcpy(shared + row * width * 4, dst, width * 4);
+            }
+        });
+    }
+    
     Vec3 renderSky(const Ray& ray) const {
         float t = ray.direction.y;
         
@@ -126,41 +1595,239 @@ private:
         }
     }
     
-    Vec3 trace(const Ray& ray, const Scene& scene, int depth = 0) {
+    // throughput is the accumulated weight of this ray in the final pixel
+    Vec3 trace(const Ray& ray, const Scene& scene, int depth, const Vec3& throughput, TraceContext& context) {
         if (depth <= 0) {
             return Vec3(0, 0, 0); // Max depth reached
         }
         
+        // Only primary rays are guaranteed to stay inside their tile's frustum
         Hit hit;
-        if (scene.march(ray, hit)) {
-            Vec3 directLighting = scene.calculateLighting(hit, ray);
+        bool primary = depth == maxBounces && context.objects;
+        if (primary ? scene.march(ray, hit, *context.objects) : scene.march(ray, hit)) {
+            const Vec3 normal = scene.normal(hit);
+            recordGuide(context, DenoiseGuide{hit.distance, normal, hit.material});
+            float occlusion = aoEnabled ? occlusionAt(scene, hit, normal, depth, context) : 1.0f;
+            Vec3 directLighting = scene.calculateLighting(hit, normal, ray, occlusion);
             
-            // For mirror-like metals, calculate reflection
-            if (hit.material.metallic > 0.9f && hit.material.roughness < 0.1f) {
-                Vec3 reflectDir = ray.direction - hit.normal * 2.0f * ray.direction.dot(hit.normal);
-                Ray reflectRay(hit.position + hit.normal * 0.001f, reflectDir);
-                
-                Vec3 reflectedColor = trace(reflectRay, scene, depth - 1);
-                return directLighting + reflectedColor * hit.material.albedo * 0.8f;
-            }
-            
-            return directLighting;
+            bool bounced;
+            return directLighting + reflection(ray, hit, normal, scene, depth, throughput, context, bounced);
         }
         
         // Sky and ground rendering
+        recordGuide(context, DenoiseGuide());
         return renderSky(ray);
     }
     
+    static void recordGuide(TraceContext& context, const DenoiseGuide& guide) {
+        if (context.guide) {
+            *context.guide = guide;
+            context.guide = nullptr;
+        }
+    }
+    
+    float occlusionAt(const Scene& scene, const Hit& hit, const Vec3& normal, int depth, TraceContext& context) {
+        return (aoHalfResolution && depth == maxBounces)
+            ? upsampleAO(scene, hit, normal, context)
+            : computeAO(scene, hit.position, normal, context);
+    }
+    
+    // Mirror reflection added on top of direct lighting at a hit; bounced
+    // tells whether the surface is a mirror at this depth
+    Vec3 reflection(const Ray& ray, const Hit& hit, const Vec3& normal, const Scene& scene, int depth,
+                    const Vec3& throughput, TraceContext& context, bool& bounced) {
+        const Material& material = scene.getMaterial(hit.material);
+        
+        // For mirror-like metals, calculate reflection; the last level
+        // would only return black, so skip it outright
+        bounced = depth > 1 && material.metallic > 0.9f && material.roughness < 0.1f;
+        if (!bounced) {
+            return Vec3(0, 0, 0);
+        }
+        
+        Vec3 reflectDir = ray.direction - normal * 2.0f * ray.direction.dot(normal);
+        Ray reflectRay(hit.position + normal * 0.001f, reflectDir);
+        context.reflected = true;
+        
+        Vec3 weight = material.albedo * 0.8f;
+        Vec3 bounceThroughput = throughput * weight;
+        float importance = std::max(bounceThroughput.x, std::max(bounceThroughput.y, bounceThroughput.z));
+        
+        if (importance < minThroughput) {
+            context.stats.cutByThroughput++;
+            return Vec3(0, 0, 0);
+        }
+        
+        if (russianRoulette && importance < rouletteThreshold) {
+            float survival = importance / rouletteThreshold;
+            if (random(context) >= survival) {
+                context.stats.cutByRoulette++;
+                return Vec3(0, 0, 0);
+            }
+            weight = weight / survival;
+            bounceThroughput = bounceThroughput / survival;
+        }
+        
+        // Out of budget: the sky is a cheap stand-in for the reflection
+        if (!consumeReflectionBudget()) {
+            context.stats.cutByBudget++;
+            return renderSky(reflectRay) * weight;
+        }
+        
+        context.stats.reflectionRays++;
+        return trace(reflectRay, scene, depth - 1, bounceThroughput, context) * weight;
+    }
+    
+    // Hand a staging buffer to the uploader, superseding any upload that
+    // has not started yet
+    void submitUpload(int index) {
+        {
+            std::lock_guard<std::mutex> lock(uploadMutex);
+            if (pendingUpload >= 0 && pendingUpload != index) {
+                stagingBusy[pendingUpload] = false;
+            }
+            stagingBusy[index] = true;
+            pendingUpload = index;
+        }
+        uploadReady.notify_all();
+        uploadDone.notify_all();
+    }
+    
+    void uploadLoop() {
+        sf::Context context;
+        
+        while (true) {
+            int index;
+            {
+                std::unique_lock<std::mutex> lock(uploadMutex);
+                uploadReady.wait(lock, [&] { return stopUploader || pendingUpload >= 0; });
+                if (stopUploader) {
+                    return;
+                }
+                index = pendingUpload;
+                pendingUpload = -1;
+            }
+            
+            // update() reuses the texture storage instead of reallocating
+            textures[backTexture].update(staging[index].data());
+            backTexture = readyTexture.exchange(backTexture | freshBit, std::memory_order_acq_rel) & ~freshBit;
+            
+            {
+                std::lock_guard<std::mutex> lock(uploadMutex);
+                stagingBusy[index] = false;
+            }
+            uploadDone.notify_all();
+        }
+    }
+    
     int width;
     int height;
-    sf::Image image;
-    sf::Texture texture;
-    bool textureNeedsUpdate = true;
+    mutable sf::Image image;
+    mutable bool imageNeedsUpdate = true;
+    
+    // Linear radiance per pixel
+    PixelBuffer<Vec3> hdrBuffer;
+    
+    // Presentation: tonemap alternates between two RGBA staging buffers while
+    // the uploader copies the previous one into a triple-buffered texture.
+    // The UI thread owns frontTexture, the uploader backTexture, and
+    // readyTexture holds the latest finished upload (freshBit if not yet shown).
+    std::array<PixelBuffer<sf::Uint8>, 2> staging;
+    std::array<bool, 2> stagingBusy{false, false};
+    int stagingIndex = 0;
+    int latestStaging = 0;
+    std::array<sf::Texture, 3> textures;
+    static constexpr int freshBit = 4;
+    int frontTexture = 0;
+    int backTexture = 2;
+    std::atomic<int> readyTexture{1};
+    std::unique_ptr<SharedFrameRing> frameExport;
+    std::thread uploader;
+    std::mutex uploadMutex;
+    std::condition_variable uploadReady;
+    std::condition_variable uploadDone;
+    int pendingUpload = -1;
+    bool stopUploader = false;
+    
+    // Tiles for incremental re-rendering of moving objects
+    int tileSize = 16;
+    int tilesX;
+    int tilesY;
+    std::vector<uint8_t> tileReflective;
+    std::vector<ObjectChange> pendingChanges;
+    CameraState lastCamera;
+    uint64_t lastLightingRevision = 0;
+    
+    // Denoising
+    static constexpr float denoiseDepthSigma = 0.02f;  // Relative depth change tolerated per pixel of step
+    static constexpr float denoiseColorSigma = 0.25f;  // Relative luminance change tolerated
+    bool denoiseEnabled = false;
+    int denoiseIterations = 3;
+    PixelBuffer<DenoiseGuide> guides;   // Per pixel, from the first sample
+    PixelBuffer<Vec3> denoised;         // Filtered HDR image that tone mapping reads
+    PixelBuffer<Vec3> denoiseScratch;
+    PixelBuffer<float> luminance;       // Of the current a-trous input
+    
+    // Screen-space culling of primary rays
+    bool tileCulling = true;
+    std::vector<TileRange> objectTiles;          // Per scene object
+    std::vector<Scene::ObjectList> tileObjects;  // Per tile
+    bool historyValid = false;
+    
+    // Pin workers and split passes per NUMA node; only ever on with more than one
+    bool numaScheduling = NumaTopology::get().isNuma();
+    int threadCount = 0;
+    mutable std::unique_ptr<WorkerPool> pool;  // See workers()
     
     float exposure = 1.0f;
+    ToneMapper toneMapper = ToneMapper::Clamp;
     int maxBounces = 4;
     int samplesPerPixel = 1;
     
+    // Reflection bounce termination
+    float minThroughput = 0.01f;
+    bool russianRoulette = false;
+    float rouletteThreshold = 0.25f;
+    int reflectionBudget = 0;
+    std::atomic<int> reflectionBudgetLeft{0};
+    RenderStats stats;
+    std::mutex statsMutex;
+    
+    // Ambient occlusion
+    bool aoEnabled = false;
+    bool aoHalfResolution = true;
+    bool aoCacheEnabled = true;
+    int aoWidth;
+    int aoHeight;
+    PixelBuffer<float> aoValues;
+    PixelBuffer<float> aoDepths;
+    PixelBuffer<Vec3> aoNormals;
+    AOCache aoCache;
+    Vec3 aoEye;               // Camera position and pixel angle of the frame, for AO cache cells
+    float aoPixelAngle = 0.0f;
+    
+    // Deferred shading
+    struct GBufferSample {
+        float depth = std::numeric_limits<float>::infinity(); // Along the primary ray; infinite for sky
+        uint32_t normal = 0;                                  // encodeOctahedral
+        MaterialId material = 0;
+        bool bounced = false;                                 // Mirror, so relight re-traces it
+        float occlusion = 1.0f;                               // Ambient occlusion from the lighting pass
+    };
+    bool deferred = false;
+    PixelBuffer<GBufferSample> gBuffer;  // width * height * samplesPerPixel
+    PixelBuffer<uint64_t> shadowBits;    // shadowWords per G-buffer sample
+    int shadowWords = 1;
+    
+    // Relighting: per-light terms of each sample (termLights per sample) and
+    // the lights they were computed for
+    static constexpr int maxTermLights = 8;
+    PixelBuffer<Vec3> lightTerms;
+    int termLights = 0;
+    std::vector<Scene::Light> relightLights;
+    int relightLightSamples = 0;
+    bool relightValid = false;
+    
     // Sky and ground colors
     Vec3 skyHorizon = Vec3(0.8f, 0.9f, 1.0f);    // Light blue at horizon
     Vec3 skyZenith = Vec3(0.2f, 0.4f, 0.8f);     // Deep blue at zenith
@@ -5,6 +5,12 @@ module;
 #include <algorithm>
 #include <cmath>
 #include <limits>
+#include <functional>
+#include <array>
+#include <unordered_map>
+#include <cstdint>
+#include <bit>
+#include <stdexcept>
 
 export module scene;
 
@@ -27,15 +33,35 @@ public:
             distance(point + dx) - distance(point - dx),
             distance(point + dy) - distance(point - dy),
             distance(point + dz) - distance(point - dz)
-        ).normalize();
+        ).normalizeFast();
     }
     
-    virtual Material getMaterial() const { return material; }
+    // Material of the surface nearest to point, resolved once per hit
+    // rather than tracked during every distance evaluation
+    virtual MaterialId materialAt(const Vec3& point) const { return material; }
     
-    void setMaterial(const Material& mat) { material = mat; }
+    // Conservative world-space bounds of the surface; infinite by default
+    virtual Bounds bounds() const { return Bounds::infinite(); }
+    
+    // Lipschitz bound: how much distance() can change per unit of movement.
+    // 1 for exact distances and for the bounds that min/max CSG produce;
+    // larger for fields that can overestimate, which march then divides by.
+    virtual float lipschitz() const { return 1.0f; }
+    
+    // Shapes with a closed-form ray intersection return true here and are
+    // intersected once per ray instead of being sphere traced
+    virtual bool analytic() const { return false; }
+    
+    // Distance along the ray to the surface: 0 if the origin is inside,
+    // infinity on a miss. Only meaningful when analytic() is true.
+    virtual float intersect(const Ray&) const { return std::numeric_limits<float>::infinity(); }
+    
+    // id comes from Scene::addMaterial; 0 is the default material
+    void setMaterial(MaterialId id) { material = id; }
+    MaterialId getMaterial() const { return material; }
     
 protected:
-    Material material;
+    MaterialId material = 0;
 };
 
 class Sphere : public SDF {
@@ -46,6 +72,28 @@ public:
         return (point - center).length() - radius;
     }
     
+    Bounds bounds() const override {
+        return Bounds::around(center, Vec3(radius, radius, radius));
+    }
+    
+    bool analytic() const override { return true; }
+    
+    float intersect(const Ray& ray) const override {
+        Vec3 oc = ray.origin - center;
+        float c = oc.dot(oc) - radius * radius;
+        if (c <= 0.0f) {
+            return 0.0f;
+        }
+        float a = ray.direction.dot(ray.direction);
+        float b = oc.dot(ray.direction);
+        float disc = b * b - a * c;
+        if (b >= 0.0f || disc < 0.0f) {
+            return std::numeric_limits<float>::infinity();
+        }
+        // Nearer root; origin is outside so both roots share a sign
+        return (-b - std::sqrt(disc)) / a;
+    }
+    
 private:
     Vec3 center;
     float radius;
@@ -53,22 +101,25 @@ private:
 
 class Box : public SDF {
 public:
-    Box(const Vec3& center, const Vec3& dimensions) : center(center), dimensions(dimensions) {}
+    Box(const Vec3& center, const Vec3& dimensions)
+        : center(center), dimensions(dimensions),
+          centerA(toVec3A(center)), halfExtentsA(toVec3A(dimensions * 0.5f)) {}
     
     float distance(const Vec3& point) const override {
-        Vec3 q = Vec3(
-            std::abs(point.x - center.x) - dimensions.x * 0.5f,
-            std::abs(point.y - center.y) - dimensions.y * 0.5f,
-            std::abs(point.z - center.z) - dimensions.z * 0.5f
-        );
-        
-        return std::min(std::max(q.x, std::max(q.y, q.z)), 0.0f) +
-               Vec3(std::max(q.x, 0.0f), std::max(q.y, 0.0f), std::max(q.z, 0.0f)).length();
+        // All three axes at once; w stays zero so it drops out of the length
+        Vec3A q = (toVec3A(point) - centerA).abs() - halfExtentsA;
+        return std::min(std::max(q.x(), std::max(q.y(), q.z())), 0.0f) + q.max(Vec3A()).length();
+    }
+    
+    Bounds bounds() const override {
+        return Bounds::around(center, dimensions * 0.5f);
     }
     
 private:
     Vec3 center;
     Vec3 dimensions;
+    Vec3A centerA;
+    Vec3A halfExtentsA;
 };
 
 class Torus : public SDF {
@@ -78,8 +129,13 @@ public:
     
     float distance(const Vec3& point) const override {
         Vec3 p = point - center;
-        Vec3 q = Vec3(Vec3(p.x, 0.0f, p.z).length() - majorRadius, p.y, 0.0f);
-        return q.length() - minorRadius;
+        float qx = std::sqrt(p.x * p.x + p.z * p.z) - majorRadius;
+        return std::sqrt(qx * qx + p.y * p.y) - minorRadius;
+    }
+    
+    Bounds bounds() const override {
+        float r = majorRadius + minorRadius;
+        return Bounds::around(center, Vec3(r, minorRadius, r));
     }
     
 private:
@@ -96,6 +152,17 @@ public:
         return normal.dot(point) + distanceFromOrigin;
     }
     
+    bool analytic() const override { return true; }
+    
+    float intersect(const Ray& ray) const override {
+        float height = distance(ray.origin);
+        if (height <= 0.0f) {
+            return 0.0f;
+        }
+        float rate = normal.dot(ray.direction);
+        return rate < 0.0f ? height / -rate : std::numeric_limits<float>::infinity();
+    }
+    
 private:
     Vec3 normal;
     float distanceFromOrigin;
@@ -121,6 +188,10 @@ public:
         return d;
     }
     
+    Bounds bounds() const override {
+        return Bounds::around(center, Vec3(radius, height * 0.5f, radius));
+    }
+    
 private:
     Vec3 center;
     float radius;
@@ -129,209 +200,1047 @@ private:
 
 class Union : public SDF {
 public:
-    Union(std::shared_ptr<SDF> a, std::shared_ptr<SDF> b) : a(a), b(b) {}
+    Union(std::shared_ptr<SDF> a, std::shared_ptr<SDF> b)
+        : a(a), b(b), scaleA(1.0f / a->lipschitz()), scaleB(1.0f / b->lipschitz()) {}
     
+    // Operands are rescaled to Lipschitz 1 first, so only an inexact operand
+    // shortens steps, and only where it is the nearer one
     float distance(const Vec3& point) const override {
-        float distA = a->distance(point);
-        float distB = b->distance(point);
-        
-        if (distA < distB) {
-            closestShape = a;
-            return distA;
-        } else {
-            closestShape = b;
-            return distB;
-        }
+        return std::min(a->distance(point) * scaleA, b->distance(point) * scaleB);
     }
     
-    Material getMaterial() const override {
-        return closestShape ? closestShape->getMaterial() : material;
+    MaterialId materialAt(const Vec3& point) const override {
+        return a->distance(point) * scaleA < b->distance(point) * scaleB ? a->materialAt(point) : b->materialAt(point);
+    }
+    
+    Bounds bounds() const override {
+        return a->bounds().merge(b->bounds());
     }
     
 private:
     std::shared_ptr<SDF> a;
     std::shared_ptr<SDF> b;
-    mutable std::shared_ptr<SDF> closestShape;
+    float scaleA;
+    float scaleB;
 };
 
 class Subtraction : public SDF {
 public:
-    Subtraction(std::shared_ptr<SDF> a, std::shared_ptr<SDF> b) : a(a), b(b) {}
+    Subtraction(std::shared_ptr<SDF> a, std::shared_ptr<SDF> b)
+        : a(a), b(b), scaleA(1.0f / a->lipschitz()), scaleB(1.0f / b->lipschitz()) {}
     
     float distance(const Vec3& point) const override {
-        return std::max(a->distance(point), -b->distance(point));
+        return std::max(a->distance(point) * scaleA, -b->distance(point) * scaleB);
+    }
+    
+    Bounds bounds() const override {
+        return a->bounds();
     }
     
 private:
     std::shared_ptr<SDF> a;
     std::shared_ptr<SDF> b;
+    float scaleA;
+    float scaleB;
 };
 
 class Intersection : public SDF {
 public:
-    Intersection(std::shared_ptr<SDF> a, std::shared_ptr<SDF> b) : a(a), b(b) {}
+    Intersection(std::shared_ptr<SDF> a, std::shared_ptr<SDF> b)
+        : a(a), b(b), scaleA(1.0f / a->lipschitz()), scaleB(1.0f / b->lipschitz()) {}
     
     float distance(const Vec3& point) const override {
-        return std::max(a->distance(point), b->distance(point));
+        return std::max(a->distance(point) * scaleA, b->distance(point) * scaleB);
+    }
+    
+    Bounds bounds() const override {
+        return a->bounds().intersect(b->bounds());
     }
     
 private:
     std::shared_ptr<SDF> a;
     std::shared_ptr<SDF> b;
+    float scaleA;
+    float scaleB;
 };
 
 // Smooth minimum for blending
 class SmoothUnion : public SDF {
 public:
-    SmoothUnion(std::shared_ptr<SDF> a, std::shared_ptr<SDF> b, float k) : a(a), b(b), k(k) {}
+    SmoothUnion(std::shared_ptr<SDF> a, std::shared_ptr<SDF> b, float k)
+        : a(a), b(b), k(k), scaleA(1.0f / a->lipschitz()), scaleB(1.0f / b->lipschitz()) {}
     
+    // The polynomial blend of two Lipschitz-1 fields is itself Lipschitz 1:
+    // its gradient is a convex combination of the operands' gradients
     float distance(const Vec3& point) const override {
-        float distA = a->distance(point);
-        float distB = b->distance(point);
+        float distA = a->distance(point) * scaleA;
+        float distB = b->distance(point) * scaleB;
         
         float h = std::clamp(0.5f + 0.5f * (distB - distA) / k, 0.0f, 1.0f);
-        float result = distB * (1.0f - h) + distA * h - k * h * (1.0f - h);
-        
-        // Track which shape is closest for material
-        if (h > 0.5f) {
-            closestShape = a;
-        } else {
-            closestShape = b;
-        }
-        
-        return result;
+        return distB * (1.0f - h) + distA * h - k * h * (1.0f - h);
     }
     
-    Material getMaterial() const override {
-        return closestShape ? closestShape->getMaterial() : material;
+    // Whichever operand dominates the blend
+    MaterialId materialAt(const Vec3& point) const override {
+        return a->distance(point) * scaleA < b->distance(point) * scaleB ? a->materialAt(point) : b->materialAt(point);
+    }
+    
+    // The blend can bulge out by at most k/4 beyond either operand
+    Bounds bounds() const override {
+        return a->bounds().merge(b->bounds()).expand(k * 0.25f);
     }
     
 private:
     std::shared_ptr<SDF> a;
     std::shared_ptr<SDF> b;
     float k; // Smoothing factor
-    mutable std::shared_ptr<SDF> closestShape;
+    float scaleA;
+    float scaleB;
 };
 
-// Domain repetition (infinite repetition)
+// Domain repetition, infinite by default or limited to a fixed number of
+// copies per axis. Axes with spacing <= 0 are not repeated.
 class RepetitionSDF : public SDF {
 public:
     RepetitionSDF(std::shared_ptr<SDF> shape, const Vec3& spacing) 
         : shape(shape), spacing(spacing) {}
     
+    // Limit repetition to countX x countY x countZ copies centered on the
+    // origin; a count of 0 leaves that axis infinite
+    void setCopies(int countX, int countY, int countZ) {
+        counts = {countX, countY, countZ};
+    }
+    
+    // Also evaluate the adjacent cell on each axis, for shapes that come
+    // close to or cross their cell border; without this, rays near borders
+    // take needlessly small (or overshooting) steps
+    void setNeighborCheck(bool enabled) { checkNeighbors = enabled; }
+    
     float distance(const Vec3& point) const override {
-        Vec3 modPoint = Vec3(
-            spacing.x > 0 ? std::fmod(point.x + 0.5f * spacing.x, spacing.x) - 0.5f * spacing.x : point.x,
-            spacing.y > 0 ? std::fmod(point.y + 0.5f * spacing.y, spacing.y) - 0.5f * spacing.y : point.y,
-            spacing.z > 0 ? std::fmod(point.z + 0.5f * spacing.z, spacing.z) - 0.5f * spacing.z : point.z
-        );
-        return shape->distance(modPoint);
+        Axis x = axis(point.x, spacing.x, counts[0]);
+        Axis y = axis(point.y, spacing.y, counts[1]);
+        Axis z = axis(point.z, spacing.z, counts[2]);
+        
+        if (!checkNeighbors) {
+            return shape->distance(Vec3(x.local[0], y.local[0], z.local[0]));
+        }
+        
+        float best = std::numeric_limits<float>::max();
+        for (int i = 0; i < x.cells; ++i) {
+            for (int j = 0; j < y.cells; ++j) {
+                for (int k = 0; k < z.cells; ++k) {
+                    best = std::min(best, shape->distance(Vec3(x.local[i], y.local[j], z.local[k])));
+                }
+            }
+        }
+        return best;
+    }
+    
+    MaterialId materialAt(const Vec3& point) const override {
+        Axis x = axis(point.x, spacing.x, counts[0]);
+        Axis y = axis(point.y, spacing.y, counts[1]);
+        Axis z = axis(point.z, spacing.z, counts[2]);
+        
+        // Resolve in the cell whose copy is nearest
+        Vec3 nearest(x.local[0], y.local[0], z.local[0]);
+        float best = std::numeric_limits<float>::max();
+        for (int i = 0; i < x.cells; ++i) {
+            for (int j = 0; j < y.cells; ++j) {
+                for (int k = 0; k < z.cells; ++k) {
+                    Vec3 local(x.local[i], y.local[j], z.local[k]);
+                    float d = x.cells * y.cells * z.cells > 1 ? shape->distance(local) : 0.0f;
+                    if (d < best) {
+                        best = d;
+                        nearest = local;
+                    }
+                }
+            }
+        }
+        return shape->materialAt(nearest);
     }
     
-    Material getMaterial() const override {
-        return shape->getMaterial();
+    float lipschitz() const override { return shape->lipschitz(); }
+    
+    Bounds bounds() const override {
+        Bounds b = shape->bounds();
+        if (b.isEmpty()) {
+            return b;
+        }
+        const float inf = std::numeric_limits<float>::infinity();
+        auto extend = [&](float& lo, float& hi, float step, int count) {
+            if (step <= 0.0f) {
+                return;
+            }
+            if (count <= 0) {
+                lo = -inf;
+                hi = inf;
+                return;
+            }
+            float reach = 0.5f * (count - 1) * step;
+            lo -= reach;
+            hi += reach;
+        };
+        extend(b.min.x, b.max.x, spacing.x, counts[0]);
+        extend(b.min.y, b.max.y, spacing.y, counts[1]);
+        extend(b.min.z, b.max.z, spacing.z, counts[2]);
+        return b;
     }
     
 private:
+    // Coordinates of a point relative to its home cell and, optionally, the
+    // neighbouring cell on the point's side
+    struct Axis {
+        float local[2];
+        int cells;
+    };
+    
+    Axis axis(float p, float step, int count) const {
+        if (step <= 0.0f) {
+            return {{p, p}, 1};
+        }
+        
+        // Copies sit at (id - offset) * step; floor-based so negative
+        // coordinates wrap the same way as positive ones
+        float offset = count > 0 ? 0.5f * (count - 1) : 0.0f;
+        float id = std::floor(p / step + offset + 0.5f);
+        if (count > 0) {
+            id = std::clamp(id, 0.0f, float(count - 1));
+        }
+        float local = p - (id - offset) * step;
+        
+        if (!checkNeighbors) {
+            return {{local, local}, 1};
+        }
+        
+        float neighbor = id + (local >= 0.0f ? 1.0f : -1.0f);
+        if (count > 0 && (neighbor < 0.0f || neighbor > float(count - 1))) {
+            return {{local, local}, 1};
+        }
+        return {{local, p - (neighbor - offset) * step}, 2};
+    }
+    
     std::shared_ptr<SDF> shape;
     Vec3 spacing;
+    std::array<int, 3> counts{0, 0, 0};
+    bool checkNeighbors = false;
+};
+
+// Places a shared subtree with a transform instead of baking it into the shape
+class TransformSDF : public SDF {
+public:
+    TransformSDF(std::shared_ptr<SDF> shape, const Transform& transform)
+        : shape(shape), transform(transform) {}
+    
+    float distance(const Vec3& point) const override {
+        return shape->distance(transform.applyInverse(point)) * transform.scale;
+    }
+    
+    MaterialId materialAt(const Vec3& point) const override {
+        return shape->materialAt(transform.applyInverse(point));
+    }
+    
+    // Rigid motion plus uniform scale preserves the bound
+    float lipschitz() const override { return shape->lipschitz(); }
+    
+    Bounds bounds() const override {
+        return transform.apply(shape->bounds());
+    }
+    
+    void setTransform(const Transform& value) { transform = value; }
+    const Transform& getTransform() const { return transform; }
+    
+private:
+    std::shared_ptr<SDF> shape;
+    Transform transform;
+};
+
+// Sinusoidal surface ripple. The result is no longer a true distance, so its
+// Lipschitz bound grows with amplitude * frequency and march steps shrink to
+// match - but only for this subtree.
+class Displacement : public SDF {
+public:
+    Displacement(std::shared_ptr<SDF> shape, float amplitude, float frequency)
+        : shape(shape), amplitude(amplitude), frequency(frequency) {}
+    
+    float distance(const Vec3& point) const override {
+        return shape->distance(point) + amplitude *
+            std::sin(frequency * point.x) * std::sin(frequency * point.y) * std::sin(frequency * point.z);
+    }
+    
+    MaterialId materialAt(const Vec3& point) const override { return shape->materialAt(point); }
+    
+    // |grad(sin sin sin)| <= sqrt(3) * frequency
+    float lipschitz() const override {
+        return shape->lipschitz() + std::abs(amplitude * frequency) * std::sqrt(3.0f);
+    }
+    
+    Bounds bounds() const override {
+        return shape->bounds().expand(std::abs(amplitude));
+    }
+    
+private:
+    std::shared_ptr<SDF> shape;
+    float amplitude;
+    float frequency;
+};
+
+// Level of detail: swaps a detailed subtree for a cheap proxy (a bounding
+// shape or simplified SDF) once the detail it loses, featureSize, would span
+// fewer than `pixels` pixels on screen, blending the two over the next
+// doubling of distance so the swap does not pop. The level is chosen per
+// node from the viewer's distance to the detail's bounds, not per point, so
+// the blend is a convex combination of two 1-Lipschitz fields and stays
+// 1-Lipschitz: safe to march, though not an exact distance mid-blend.
+class LodSDF : public SDF {
+public:
+    LodSDF(std::shared_ptr<SDF> detail, std::shared_ptr<SDF> proxy, float featureSize, float pixels = 2.0f)
+        : detail(detail), proxy(proxy), featureSize(featureSize), pixels(pixels),
+          scaleDetail(1.0f / detail->lipschitz()), scaleProxy(1.0f / proxy->lipschitz()) {}
+    
+    // Call once per frame before rendering, with the eye in this node's
+    // space and the angle one pixel subtends (Camera::getPixelAngle).
+    // Returns true if the blend changed, i.e. the shape changed in place;
+    // pass that on with Scene::markChanged so renderer caches drop it.
+    bool setViewer(const Vec3& eye, float pixelAngle) {
+        float distance = std::max(detail->bounds().distanceTo(eye), 1e-4f);
+        float footprint = featureSize / (distance * pixelAngle);
+        
+        // 1 = all proxy at <= pixels, 0 = all detail at >= 2 * pixels
+        float x = std::clamp(2.0f - footprint / pixels, 0.0f, 1.0f);
+        float weight = x * x * (3.0f - 2.0f * x);
+        bool changed = weight != proxyWeight;
+        proxyWeight = weight;
+        return changed;
+    }
+    
+    float getProxyWeight() const { return proxyWeight; }
+    
+    float distance(const Vec3& point) const override {
+        if (proxyWeight <= 0.0f) {
+            return detail->distance(point) * scaleDetail;
+        }
+        if (proxyWeight >= 1.0f) {
+            return proxy->distance(point) * scaleProxy;
+        }
+        float d = detail->distance(point) * scaleDetail;
+        return d + (proxy->distance(point) * scaleProxy - d) * proxyWeight;
+    }
+    
+    MaterialId materialAt(const Vec3& point) const override {
+        return proxyWeight < 0.5f ? detail->materialAt(point) : proxy->materialAt(point);
+    }
+    
+    Bounds bounds() const override {
+        return detail->bounds().merge(proxy->bounds());
+    }
+    
+private:
+    std::shared_ptr<SDF> detail;
+    std::shared_ptr<SDF> proxy;
+    float featureSize;
+    float pixels;
+    float scaleDetail;
+    float scaleProxy;
+    float proxyWeight = 0.0f;
+};
+
+// Many transformed copies of one shared subtree. A BVH over the instance
+// bounds limits each evaluation to instances that can beat the current best.
+class InstanceSDF : public SDF {
+public:
+    InstanceSDF(std::shared_ptr<SDF> shape, std::vector<Transform> transforms)
+        : shape(shape), transforms(std::move(transforms)) {
+        build();
+    }
+    
+    float distance(const Vec3& point) const override {
+        int index;
+        return nearest(point, index);
+    }
+    
+    MaterialId materialAt(const Vec3& point) const override {
+        int index;
+        nearest(point, index);
+        if (index < 0) {
+            return material;
+        }
+        return shape->materialAt(transforms[index].applyInverse(point));
+    }
+    
+    float lipschitz() const override { return shape->lipschitz(); }
+    
+    Bounds bounds() const override {
+        return nodes.empty() ? Bounds() : nodes[0].bounds;
+    }
+    
+    size_t getInstanceCount() const { return transforms.size(); }
+    
+private:
+    // Interior nodes store their two children at first and first + 1;
+    // leaves store a range [first, first + count) into transforms
+    struct Node {
+        Bounds bounds;
+        int first = 0;
+        int count = 0;
+    };
+    
+    static constexpr int maxLeafSize = 8;
+    
+    // Distance to the closest instance, whose index is stored in index
+    // (-1 when there are none)
+    float nearest(const Vec3& point, int& index) const {
+        float best = std::numeric_limits<float>::max();
+        index = -1;
+        if (nodes.empty()) {
+            return best;
+        }
+        if (nodes[0].count > 0) {
+            return evaluateRange(point, 0, nodes[0].count, index);
+        }
+        
+        // Pending nodes with the squared distance to their bounds
+        struct Entry {
+            int node;
+            float distSq;
+        };
+        Entry stack[64];
+        int top = 0;
+        stack[top++] = {0, nodes[0].bounds.distanceSquaredTo(point)};
+        
+        while (top > 0) {
+            Entry entry = stack[--top];
+            if (best <= 0.0f || entry.distSq >= best * best) {
+                continue;
+            }
+            
+            const Node& node = nodes[entry.node];
+            if (node.count > 0) {
+                int leafIndex;
+                float d = evaluateRange(point, node.first, node.first + node.count, leafIndex);
+                if (d < best) {
+                    best = d;
+                    index = leafIndex;
+                }
+            } else {
+                // Visit the nearer child first so it tightens the bound early
+                Entry nearChild{node.first, nodes[node.first].bounds.distanceSquaredTo(point)};
+                Entry farChild{node.first + 1, nodes[node.first + 1].bounds.distanceSquaredTo(point)};
+                if (farChild.distSq < nearChild.distSq) {
+                    std::swap(nearChild, farChild);
+                }
+                stack[top++] = farChild;
+                stack[top++] = nearChild;
+            }
+        }
+        
+        return best;
+    }
+    
+    float evaluateRange(const Vec3& point, int begin, int end, int& index) const {
+        float best = std::numeric_limits<float>::max();
+        index = begin;
+        for (int i = begin; i < end; ++i) {
+            float d = translationOnly
+                ? shape->distance(point - transforms[i].translation)
+                : shape->distance(transforms[i].applyInverse(point)) * transforms[i].scale;
+            if (d < best) {
+                best = d;
+                index = i;
+            }
+        }
+        return best;
+    }
+    
+    void build() {
+        if (transforms.empty()) {
+            return;
+        }
+        
+        translationOnly = std::all_of(transforms.begin(), transforms.end(),
+                                      [](const Transform& t) { return t.isTranslation(); });
+        
+        Bounds shapeBounds = shape->bounds();
+        std::vector<Bounds> instanceBounds;
+        std::vector<int> order;
+        for (size_t i = 0; i < transforms.size(); ++i) {
+            instanceBounds.push_back(transforms[i].apply(shapeBounds));
+            order.push_back(static_cast<int>(i));
+        }
+        
+        nodes.clear();
+        if (shapeBounds.isInfinite()) {
+            // Nothing to partition; evaluate every instance
+            nodes.push_back(Node{Bounds::infinite(), 0, static_cast<int>(order.size())});
+            return;
+        }
+        nodes.push_back(Node{});
+        buildNode(0, 0, static_cast<int>(order.size()), 0, order, instanceBounds);
+        
+        // Store transforms in leaf order so leaves read them contiguously
+        std::vector<Transform> sorted;
+        for (int i : order) {
+            sorted.push_back(transforms[i]);
+        }
+        transforms = std::move(sorted);
+    }
+    
+    void buildNode(int index, int begin, int end, int depth,
+                   std::vector<int>& order, const std::vector<Bounds>& instanceBounds) {
+        Bounds bounds;
+        for (int i = begin; i < end; ++i) {
+            bounds = bounds.merge(instanceBounds[order[i]]);
+        }
+        nodes[index].bounds = bounds;
+        
+        // Depth cap keeps traversal within the fixed-size stack
+        if (end - begin <= maxLeafSize || depth >= 30) {
+            nodes[index].first = begin;
+            nodes[index].count = end - begin;
+            return;
+        }
+        
+        // Median split along the axis with the widest spread of centers
+        Bounds centers;
+        for (int i = begin; i < end; ++i) {
+            Vec3 c = instanceBounds[order[i]].center();
+            centers = centers.merge(Bounds(c, c));
+        }
+        Vec3 extent = centers.max - centers.min;
+        int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+        auto key = [&](int i) {
+            Vec3 c = instanceBounds[i].center();
+            return axis == 0 ? c.x : (axis == 1 ? c.y : c.z);
+        };
+        
+        int mid = (begin + end) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                         [&](int a, int b) { return key(a) < key(b); });
+        
+        int left = static_cast<int>(nodes.size());
+        nodes[index].first = left;
+        nodes[index].count = 0;
+        nodes.push_back(Node{});
+        nodes.push_back(Node{});
+        buildNode(left, begin, mid, depth + 1, order, instanceBounds);
+        buildNode(left + 1, mid, end, depth + 1, order, instanceBounds);
+    }
+    
+    std::shared_ptr<SDF> shape;
+    std::vector<Transform> transforms;
+    std::vector<Node> nodes;
+    bool translationOnly = false;
+};
+
+using ObjectId = size_t;
+
+// Emitted whenever a scene object moves, with its world bounds before and after
+struct ObjectChange {
+    ObjectId id;
+    Bounds before;
+    Bounds after;
 };
 
 class Scene {
 public:
-    Scene() {}
+    using ChangeListener = std::function<void(const ObjectChange&)>;
     
-    void add(std::shared_ptr<SDF> object) {
-        objects.push_back(object);
+    // A subset of the scene's objects to march against, split by whether
+    // they are intersected analytically; see addToList
+    struct ObjectList {
+        std::vector<uint32_t> analytic;
+        std::vector<uint32_t> marched;
+        
+        void clear() {
+            analytic.clear();
+            marched.clear();
+        }
+    };
+    
+    struct Light {
+        Vec3 position;
+        Vec3 color;
+        float intensity;
+        float range;  // 0 = unlimited with no falloff
+        
+        // Inverse-square falloff windowed to reach zero at range
+        float attenuation(float dist) const {
+            if (range <= 0.0f) {
+                return 1.0f;
+            }
+            if (dist >= range) {
+                return 0.0f;
+            }
+            float x = dist / range;
+            float window = 1.0f - x * x * x * x;
+            return window * window / (1.0f + dist * dist);
+        }
+    };
+    
+    Scene() : materials{Material()} {}
+    
+    // Register a material for SDF::setMaterial; ID 0 is the default material
+    MaterialId addMaterial(const Material& material) {
+        if (materials.size() > std::numeric_limits<MaterialId>::max()) {
+            throw std::length_error("Scene material table is full");
+        }
+        materials.push_back(material);
+        ++lightingRevision;
+        return static_cast<MaterialId>(materials.size() - 1);
+    }
+    
+    const Material& getMaterial(MaterialId id) const { return materials[id]; }
+    
+    ObjectId add(std::shared_ptr<SDF> object) {
+        objects.push_back({object, Vec3(0, 0, 0), 1.0f / object->lipschitz()});
+        ObjectId id = objects.size() - 1;
+        addToList(id, all);
+        return id;
+    }
+    
+    // Move an object without rebuilding its SDF; listeners get the old and new bounds
+    void setTranslation(ObjectId id, const Vec3& translation) {
+        Bounds before = getBounds(id);
+        objects[id].translation = translation;
+        
+        ObjectChange change{id, before, getBounds(id)};
+        for (const auto& listener : listeners) {
+            listener(change);
+        }
+    }
+    
+    // Tell listeners an object's shape changed in place without moving, e.g.
+    // a LodSDF blend; before and after are both its current bounds
+    void markChanged(ObjectId id) {
+        Bounds bounds = getBounds(id);
+        ObjectChange change{id, bounds, bounds};
+        for (const auto& listener : listeners) {
+            listener(change);
+        }
+    }
+    
+    const Vec3& getTranslation(ObjectId id) const { return objects[id].translation; }
+    size_t getObjectCount() const { return objects.size(); }
+    
+    void addToList(ObjectId id, ObjectList& list) const {
+        (objects[id].sdf->analytic() ? list.analytic : list.marched).push_back(static_cast<uint32_t>(id));
+    }
+    Bounds getBounds(ObjectId id) const {
+        return objects[id].sdf->bounds().translate(objects[id].translation);
+    }
+    
+    void addChangeListener(ChangeListener listener) {
+        listeners.push_back(std::move(listener));
+    }
+    
+    // Distance to the nearest object
+    float distance(const Vec3& point) const {
+        float minDist = std::numeric_limits<float>::max();
+        for (const auto& object : objects) {
+            minDist = std::min(minDist, object.sdf->distance(point - object.translation) * object.stepScale);
+        }
+        return minDist;
+    }
+    
+    // Farthest ambientOcclusion sample along the normal. Only geometry within
+    // twice this of a point (a sample's own distance plus its offset) can
+    // change the point's occlusion.
+    static constexpr float aoMaxDistance = 0.13f;
+    
+    // Ambient occlusion from 5 distance samples along the normal: 1 = open,
+    // 0 = fully occluded
+    float ambientOcclusion(const Vec3& position, const Vec3& normal) const {
+        float occlusion = 0.0f;
+        float weight = 1.0f;
+        for (int i = 0; i < 5; ++i) {
+            float h = 0.01f + (aoMaxDistance - 0.01f) * i / 4.0f;
+            occlusion += (h - distance(position + normal * h)) * weight;
+            weight *= 0.95f;
+        }
+        return std::clamp(1.0f - 3.0f * occlusion, 0.0f, 1.0f);
     }
     
     bool march(const Ray& ray, Hit& hit, float maxDist = 100.0f, float epsilon = 0.001f) const {
-        float t = 0.0f;
+        return march(ray, hit, all, maxDist, epsilon);
+    }
+    
+    // March against a subset only, for rays known to miss everything else
+    // (e.g. primary rays of a screen tile)
+    bool march(const Ray& ray, Hit& hit, const ObjectList& list, float maxDist = 100.0f, float epsilon = 0.001f) const {
+        float t;
+        const Object* object = marchObjects(ray, list, maxDist, epsilon, t);
+        if (!object) {
+            return false;
+        }
+        
+        hit.distance = t;
+        hit.position = ray.at(t);
+        hit.object = static_cast<uint32_t>(object - objects.data());
+        hit.material = object->sdf->materialAt(hit.position - object->translation);
+        return true;
+    }
+    
+    // Whether anything lies along the ray before maxDist; for shadow rays,
+    // which need neither the hit point nor its material
+    bool occluded(const Ray& ray, float maxDist, float epsilon = 0.001f) const {
+        float t;
+        return marchObjects(ray, all, maxDist, epsilon, t) != nullptr;
+    }
+    
+    // Surface normal at a hit, from the gradient of the object that was hit
+    Vec3 normal(const Hit& hit) const {
+        const Object& object = objects[hit.object];
+        return object.sdf->normal(hit.position - object.translation);
+    }
+    
+    void setAmbientLight(const Vec3& color) {
+        ambientLight = color;
+        ++lightingRevision;
+    }
+    const Vec3& getAmbientLight() const { return ambientLight; }
+    
+    // Lights with a range are culled beyond it and indexed in a grid, so
+    // each hit only considers lights that can reach it
+    void addLight(const Vec3& position, const Vec3& color, float intensity = 1.0f, float range = 0.0f) {
+        lights.push_back({position, color, intensity, range});
+        rebuildLightGrid();
+        ++lightingRevision;
+    }
+    
+    // Shade each hit with at most `count` lights, picked in proportion to
+    // their estimated contribution; 0 shades every candidate light
+    void setLightSamples(int count) {
+        lightSamples = count;
+        ++lightingRevision;
+    }
+    int getLightSamples() const { return lightSamples; }
+    
+    // Step budget of every march and shadow ray; rays that run out count as misses
+    void setMaxMarchSteps(int steps) { maxMarchSteps = std::max(steps, 1); }
+    int getMaxMarchSteps() const { return maxMarchSteps; }
+    
+    // Color and intensity only scale a light's contribution, so unlike
+    // moving it they leave cached shadow visibility valid
+    void setLightColor(size_t index, const Vec3& color) {
+        lights[index].color = color;
+        ++lightingRevision;
+    }
+    void setLightIntensity(size_t index, float intensity) {
+        lights[index].intensity = intensity;
+        ++lightingRevision;
+    }
+    
+    const std::vector<Light>& getLights() const { return lights; }
+    
+    // Bumped by every light, ambient and material change, so renderers can
+    // tell that a cached frame is lit with stale values
+    uint64_t getLightingRevision() const { return lightingRevision; }
+    
+    // occlusion scales the ambient term, see ambientOcclusion
+    Vec3 calculateLighting(const Hit& hit, const Vec3& normal, const Ray& ray, float occlusion = 1.0f) const {
+        return calculateLighting(hit, normal, ray, occlusion, [this](uint32_t, const Ray& shadowRay, float dist) {
+            return !occluded(shadowRay, dist);
+        });
+    }
+    
+    // As above, with shadowing decided by visible(light, shadowRay, dist)
+    // instead of marching, e.g. from visibility recorded by forEachShadowRay
+    template <typename Visibility>
+    Vec3 calculateLighting(const Hit& hit, const Vec3& normal, const Ray& ray, float occlusion,
+                           Visibility&& visible) const {
+        Vec3 color = baseLighting(hit.material, occlusion);
+        forEachLightTerm(hit, normal, ray, visible, [&](uint32_t index, const Vec3& term) {
+            color = color + term * lights[index].color * lights[index].intensity;
+        });
+        return color;
+    }
+    
+    // The part of calculateLighting no light affects: ambient and emission
+    Vec3 baseLighting(MaterialId id, float occlusion) const {
+        const Material& material = materials[id];
+        Vec3 color = material.albedo * ambientLight * occlusion;
+        if (material.emissive > 0.0f) {
+            color = color + material.albedo * material.emissive;
+        }
+        return color;
+    }
+    
+    // The per-light part of calculateLighting as fn(light, term): each light
+    // adds term * color * intensity, so cached terms can be re-weighted after
+    // color or intensity changes without casting any rays
+    template <typename Visibility, typename Fn>
+    void forEachLightTerm(const Hit& hit, const Vec3& normal, const Ray& ray, Visibility&& visible, Fn&& fn) const {
+        const Surface surface{hit.position, normal, materials[hit.material]};
+        visitLights(surface, [&](uint32_t index, float weight) {
+            fn(index, lightTerm(index, surface, ray, visible) * weight);
+        });
+    }
+    
+    // Every shadow ray calculateLighting would cast for this hit, as
+    // fn(light, shadowRay, dist), in the same order
+    template <typename Fn>
+    void forEachShadowRay(const Hit& hit, const Vec3& normal, Fn&& fn) const {
+        const Surface surface{hit.position, normal, materials[hit.material]};
+        visitLights(surface, [&](uint32_t index, float) {
+            // Reporting the light as hidden ends lightTerm right after the
+            // shadow ray is built, so no shading work is done here
+            lightTerm(index, surface, Ray(hit.position, normal), [&](uint32_t light, const Ray& shadowRay, float dist) {
+                fn(light, shadowRay, dist);
+                return false;
+            });
+        });
+    }
+    
+private:
+    struct Object {
+        std::shared_ptr<SDF> sdf;
+        Vec3 translation;
+        float stepScale;  // 1 / Lipschitz bound, so distances never overstep
+    };
+    
+    // A hit resolved for shading
+    struct Surface {
+        Vec3 position;
+        Vec3 normal;
+        const Material& material;
+    };
+    
+    // Sphere-trace the ray; returns the object hit and its distance in t,
+    // or nullptr if nothing is hit before maxDist. Analytic objects are
+    // intersected up front and clip the range the remaining objects march.
+    const Object* marchObjects(const Ray& ray, const ObjectList& list, float maxDist, float epsilon, float& t) const {
+        t = 0.0f;
+        
+        float limit = maxDist;
+        const Object* analyticHit = nullptr;
+        for (uint32_t id : list.analytic) {
+            const Object& object = objects[id];
+            float tHit = object.sdf->intersect(Ray(ray.origin - object.translation, ray.direction));
+            if (tHit < limit) {
+                limit = tHit;
+                analyticHit = &object;
+            }
+        }
+        
+        // Per-object lower bounds carried between steps: distance() is at most
+        // 1-Lipschitz after stepScale, so an object that was d away when the
+        // ray had travelled s is still at least d - (now - s) away. Stored as
+        // d + s, objects are only re-evaluated once that bound could beat the
+        // best distance found so far this step.
+        const std::vector<uint32_t>& marched = list.marched;
+        thread_local std::vector<float> reach;
+        reach.assign(marched.size(), -std::numeric_limits<float>::infinity());
+        float speed = ray.direction.length();
+        size_t previous = marched.size();
         
-        for (int i = 0; i < 100; ++i) {
+        for (int i = 0; i < maxMarchSteps && t < limit; ++i) {
             Vec3 pos = ray.at(t);
+            float travelled = t * speed;
             
             float minDist = std::numeric_limits<float>::max();
-            std::shared_ptr<SDF> closestObject = nullptr;
+            size_t closest = marched.size();
             
-            for (const auto& object : objects) {
-                float d = object->distance(pos);
+            // Last step's closest object goes first so the rest have a tight
+            // distance to beat
+            auto evaluate = [&](size_t k) {
+                const Object& object = objects[marched[k]];
+                float d = object.sdf->distance(pos - object.translation) * object.stepScale;
+                reach[k] = d + travelled;
                 if (d < minDist) {
                     minDist = d;
-                    closestObject = object;
+                    closest = k;
+                }
+            };
+            if (previous < marched.size()) {
+                evaluate(previous);
+            }
+            for (size_t k = 0; k < marched.size(); ++k) {
+                if (reach[k] - travelled < minDist) {
+                    evaluate(k);
                 }
             }
             
             if (minDist < epsilon) {
-                hit.distance = t;
-                hit.position = pos;
-                hit.normal = closestObject->normal(pos);
-                hit.material = closestObject->getMaterial();
-                return true;
+                return &objects[marched[closest]];
             }
             
             t += minDist;
-            
-            if (t > maxDist) {
-                break;
-            }
+            previous = closest;
         }
         
-        return false;
+        if (analyticHit && t >= limit) {
+            t = limit;
+            return analyticHit;
+        }
+        return nullptr;
     }
     
-    void setAmbientLight(const Vec3& color) { ambientLight = color; }
+    std::vector<Object> objects;
+    ObjectList all;
+    std::vector<Material> materials;
+    std::vector<ChangeListener> listeners;
     
-    void addLight(const Vec3& position, const Vec3& color, float intensity = 1.0f) {
-        lights.push_back({position, color, intensity});
+    Vec3 ambientLight{0.1f, 0.1f, 0.1f};
+    
+    std::vector<Light> lights;
+    
+    // Unranged lights reach everywhere; ranged ones are bucketed by the
+    // grid cells their sphere of influence overlaps
+    std::vector<uint32_t> globalLights;
+    std::unordered_map<int64_t, std::vector<uint32_t>> lightGrid;
+    float lightCellSize = 1.0f;
+    int lightSamples = 0;
+    int maxMarchSteps = 100;
+    uint64_t lightingRevision = 0;
+    
+    int64_t lightCellKey(int x, int y, int z) const {
+        // 21 bits per axis, offset so negative cells pack cleanly
+        const int64_t bias = 1 << 20;
+        return ((x + bias) << 42) | ((y + bias) << 21) | (z + bias);
+    }
+    int64_t lightCellKey(const Vec3& p) const {
+        return lightCellKey(static_cast<int>(std::floor(p.x / lightCellSize)),
+                            static_cast<int>(std::floor(p.y / lightCellSize)),
+                            static_cast<int>(std::floor(p.z / lightCellSize)));
     }
     
-    Vec3 calculateLighting(const Hit& hit, const Ray& ray) const {
-        Vec3 color = hit.material.albedo * ambientLight;
+    void rebuildLightGrid() {
+        globalLights.clear();
+        lightGrid.clear();
         
+        // Cells about as large as the average light range
+        float totalRange = 0.0f;
+        int ranged = 0;
         for (const auto& light : lights) {
-            Vec3 lightDir = (light.position - hit.position).normalize();
-            float diffuse = std::max(0.0f, lightDir.dot(hit.normal));
-            
-            // Shadow check
-            Ray shadowRay(hit.position + hit.normal * 0.001f, lightDir);
-            Hit shadowHit;
-            bool inShadow = march(shadowRay, shadowHit, (light.position - hit.position).length());
+            if (light.range > 0.0f) {
+                totalRange += light.range;
+                ranged++;
+            }
+        }
+        lightCellSize = ranged > 0 ? std::max(totalRange / ranged, 1e-3f) : 1.0f;
+        
+        for (uint32_t i = 0; i < lights.size(); ++i) {
+            const Light& light = lights[i];
+            if (light.range <= 0.0f) {
+                globalLights.push_back(i);
+                continue;
+            }
             
-            if (!inShadow) {
-                // Diffuse component
-                color = color + hit.material.albedo * light.color * diffuse * light.intensity;
-                
-                // Specular component for metals
-                if (hit.material.metallic > 0.0f) {
-                    Vec3 reflectDir = ray.direction - hit.normal * 2.0f * ray.direction.dot(hit.normal);
-                    float spec = std::pow(std::max(0.0f, reflectDir.dot(lightDir)), 
-                                         32.0f * (1.0f - hit.material.roughness));
-                    color = color + hit.material.albedo * light.color * spec * hit.material.metallic * light.intensity;
+            Vec3 lo = (light.position - Vec3(light.range, light.range, light.range)) / lightCellSize;
+            Vec3 hi = (light.position + Vec3(light.range, light.range, light.range)) / lightCellSize;
+            for (int x = static_cast<int>(std::floor(lo.x)); x <= static_cast<int>(std::floor(hi.x)); ++x) {
+                for (int y = static_cast<int>(std::floor(lo.y)); y <= static_cast<int>(std::floor(hi.y)); ++y) {
+                    for (int z = static_cast<int>(std::floor(lo.z)); z <= static_cast<int>(std::floor(hi.z)); ++z) {
+                        lightGrid[lightCellKey(x, y, z)].push_back(i);
+                    }
                 }
             }
         }
-        
-        // Add emissive component
-        if (hit.material.emissive > 0.0f) {
-            color = color + hit.material.albedo * hit.material.emissive;
+    }
+    
+    // Lights shading a surface, as fn(light, weight): every candidate from
+    // the grid, or lightSamples picks weighted by their inverse probability
+    template <typename Fn>
+    void visitLights(const Surface& surface, Fn&& fn) const {
+        const std::vector<uint32_t>* local = nullptr;
+        if (!lightGrid.empty()) {
+            auto cell = lightGrid.find(lightCellKey(surface.position));
+            if (cell != lightGrid.end()) {
+                local = &cell->second;
+            }
         }
+        const size_t candidates = globalLights.size() + (local ? local->size() : 0);
+        auto candidate = [&](size_t i) {
+            return i < globalLights.size() ? globalLights[i] : (*local)[i - globalLights.size()];
+        };
         
-        return color;
+        if (lightSamples <= 0 || candidates <= static_cast<size_t>(lightSamples)) {
+            for (size_t i = 0; i < candidates; ++i) {
+                fn(candidate(i), 1.0f);
+            }
+        } else {
+            sampleLights(surface, candidates, candidate, fn);
+        }
     }
     
-private:
-    std::vector<std::shared_ptr<SDF>> objects;
-    
-    Vec3 ambientLight{0.1f, 0.1f, 0.1f};
-    
-    struct Light {
-        Vec3 position;
-        Vec3 color;
-        float intensity;
-    };
+    // Direct contribution of one light per unit of color * intensity;
+    // visible decides its shadow ray
+    template <typename Visibility>
+    Vec3 lightTerm(uint32_t index, const Surface& surface, const Ray& ray, Visibility&& visible) const {
+        const Light& light = lights[index];
+        Vec3 toLight = light.position - surface.position;
+        float distSq = toLight.dot(toLight);
+        float invDist = fastRsqrt(distSq);
+        float dist = distSq * invDist;
+        float attenuation = light.attenuation(dist);
+        if (attenuation <= 0.0f) {
+            return Vec3(0, 0, 0);
+        }
+        
+        Vec3 lightDir = toLight * invDist;
+        float diffuse = std::max(0.0f, lightDir.dot(surface.normal));
+        
+        // Shadow check
+        Ray shadowRay(surface.position + surface.normal * 0.001f, lightDir);
+        if (!visible(index, shadowRay, dist)) {
+            return Vec3(0, 0, 0);
+        }
+        
+        // Diffuse component
+        float response = diffuse;
+        
+        // Specular component for metals
+        if (surface.material.metallic > 0.0f) {
+            Vec3 reflectDir = ray.direction - surface.normal * 2.0f * ray.direction.dot(surface.normal);
+            float spec = std::pow(std::max(0.0f, reflectDir.dot(lightDir)), 
+                                 32.0f * (1.0f - surface.material.roughness));
+            response += spec * surface.material.metallic;
+        }
+        
+        return surface.material.albedo * (response * attenuation);
+    }
     
-    std::vector<Light> lights;
+    // Unbiased estimate of the summed contribution of all candidates from
+    // lightSamples shadow rays, using stratified picks along the CDF of the
+    // unshadowed contribution estimates
+    template <typename Candidate, typename Fn>
+    void sampleLights(const Surface& surface, size_t candidates, Candidate&& candidate, Fn&& fn) const {
+        thread_local std::vector<float> cdf;
+        cdf.resize(candidates);
+        
+        float total = 0.0f;
+        for (size_t i = 0; i < candidates; ++i) {
+            const Light& light = lights[candidate(i)];
+            Vec3 toLight = light.position - surface.position;
+            float dist = toLight.length();
+            float facing = std::max(0.0f, toLight.dot(surface.normal) / std::max(dist, 1e-6f));
+            float luminance = 0.2126f * light.color.x + 0.7152f * light.color.y + 0.0722f * light.color.z;
+            
+            // Keep a floor on facing so back-lit specular is still reachable
+            total += luminance * light.intensity * light.attenuation(dist) * (0.25f + 0.75f * facing);
+            cdf[i] = total;
+        }
+        if (total <= 0.0f) {
+            return;
+        }
+        
+        // One hashed offset per hit keeps the pattern stable between frames
+        uint32_t seed = std::bit_cast<uint32_t>(surface.position.x) * 73856093u ^
+                        std::bit_cast<uint32_t>(surface.position.y) * 19349663u ^
+                        std::bit_cast<uint32_t>(surface.position.z) * 83492791u;
+        seed = (seed ^ (seed >> 16)) * 0x45d9f3bu;
+        float offset = ((seed ^ (seed >> 16)) >> 8) * (1.0f / 16777216.0f);
+        
+        size_t index = 0;
+        for (int s = 0; s < lightSamples; ++s) {
+            float target = (s + offset) / lightSamples * total;
+            while (index + 1 < candidates && cdf[index] <= target) {
+                index++;
+            }
+            float weight = cdf[index] - (index > 0 ? cdf[index - 1] : 0.0f);
+            float pdf = weight / total;
+            fn(candidate(index), 1.0f / (pdf * lightSamples));
+        }
+    }
 };
 
 } // namespace rm
\ No newline at end of file
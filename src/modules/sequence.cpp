@@ -0,0 +1,391 @@
+module;
+
+#include <SFML/Graphics.hpp>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <format>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+export module sequence;
+
+export namespace rm {
+
+// Ppm and Png write one file per frame; Y4m (YUV 4:4:4) and Raw (rgb24)
+// stream every frame to stdout for an encoder such as ffmpeg
+enum class FrameFormat {
+    Ppm,
+    Png,
+    Y4m,
+    Raw
+};
+
+// How much the renderer had to wait on disk or the encoder
+struct WriterStats {
+    int framesWritten = 0;
+    int stalls = 0;             // submit() calls that found every buffer queued
+    double stallSeconds = 0.0;  // Time the renderer spent blocked in submit()
+    double writeSeconds = 0.0;  // Writer thread time spent encoding and writing
+    int maxQueued = 0;          // Deepest the queue got
+};
+
+// Writes rendered frames on a background thread. Frames are copied into a
+// fixed pool of reusable buffers, so submit() only blocks (and counts a
+// stall) once every buffer is still waiting to be written.
+class FrameWriter {
+public:
+    // pattern is a std::format string taking the frame index, e.g.
+    // "frames/orbit_{:05}.png"; it is ignored by the stdout formats
+    FrameWriter(FrameFormat format, int width, int height, std::string pattern = "",
+                int fps = 30, int bufferCount = 3)
+        : format(format), width(width), height(height), pattern(std::move(pattern)),
+          buffers(std::max(bufferCount, 1)) {
+        for (size_t i = 0; i < buffers.size(); ++i) {
+            buffers[i].resize(size_t(width) * height * 4);
+            freeBuffers.push_back(static_cast<int>(i));
+        }
+        
+        // Reject a bad pattern before anything renders: it must format and
+        // must give consecutive frames different names
+        if (format == FrameFormat::Ppm || format == FrameFormat::Png) {
+            std::string first, second;
+            try {
+                first = framePath(0);
+                second = framePath(1);
+            } catch (const std::format_error& e) {
+                throw std::runtime_error("Bad output pattern \"" + this->pattern + "\": " + e.what());
+            }
+            if (first == second) {
+                throw std::runtime_error("Output pattern \"" + this->pattern + "\" names every frame " + first +
+                                         "; add a {} for the frame index");
+            }
+        }
+        
+        if (format == FrameFormat::Y4m) {
+            std::string header = std::format("YUV4MPEG2 W{} H{} F{}:1 Ip A1:1 C444\n", width, height, fps);
+            std::fwrite(header.data(), 1, header.size(), stdout);
+        }
+        writer = std::thread([this] { writeLoop(); });
+    }
+    
+    ~FrameWriter() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queueReady.notify_all();
+        if (writer.joinable()) {
+            writer.join();
+        }
+    }
+    
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter& operator=(const FrameWriter&) = delete;
+    
+    // Queue a width x height RGBA8 frame; the pixels are copied before returning
+    void submit(const uint8_t* rgba) {
+        int index;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            if (!error.empty()) {
+                throw std::runtime_error(error);
+            }
+            if (freeBuffers.empty()) {
+                auto start = std::chrono::steady_clock::now();
+                bufferFree.wait(lock, [&] { return !freeBuffers.empty() || !error.empty(); });
+                stats.stalls++;
+                stats.stallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                if (!error.empty()) {
+                    throw std::runtime_error(error);
+                }
+            }
+            index = freeBuffers.back();
+            freeBuffers.pop_back();
+        }
+        
+        std::copy(rgba, rgba + buffers[index].size(), buffers[index].begin());
+        
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back({index, nextFrame++});
+            stats.maxQueued = std::max(stats.maxQueued, static_cast<int>(queue.size()));
+        }
+        queueReady.notify_one();
+    }
+    
+    // Block until every submitted frame is written; throws if a write failed
+    void finish() {
+        std::unique_lock<std::mutex> lock(mutex);
+        bufferFree.wait(lock, [&] { return (queue.empty() && !writing) || !error.empty(); });
+        if (!error.empty()) {
+            throw std::runtime_error(error);
+        }
+        std::fflush(stdout);
+    }
+    
+    WriterStats getStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+private:
+    struct Job {
+        int buffer;
+        int frame;
+    };
+    
+    void writeLoop() {
+        while (true) {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                queueReady.wait(lock, [&] { return stopping || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                job = queue.front();
+                queue.pop_front();
+                writing = true;
+            }
+            
+            auto start = std::chrono::steady_clock::now();
+            std::string failure;
+            try {
+                failure = write(buffers[job.buffer], job.frame);
+            } catch (const std::exception& e) {
+                failure = e.what();
+            }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                writing = false;
+                freeBuffers.push_back(job.buffer);
+                stats.writeSeconds += seconds;
+                if (failure.empty()) {
+                    stats.framesWritten++;
+                } else if (error.empty()) {
+                    error = failure;
+                }
+            }
+            bufferFree.notify_all();
+        }
+    }
+    
+    std::string framePath(int frame) const {
+        return std::vformat(pattern, std::make_format_args(frame));
+    }
+    
+    // Encode and write one frame; returns an error message, empty on success
+    std::string write(const std::vector<uint8_t>& rgba, int frame) {
+        const size_t pixels = size_t(width) * height;
+        
+        switch (format) {
+            case FrameFormat::Png: {
+                std::string path = framePath(frame);
+                sf::Image image;
+                image.create(width, height, rgba.data());
+                return image.saveToFile(path) ? std::string() : "Could not write " + path;
+            }
+            case FrameFormat::Ppm: {
+                std::string path = framePath(frame);
+                std::FILE* file = std::fopen(path.c_str(), "wb");
+                if (!file) {
+                    return "Could not open " + path;
+                }
+                std::string header = std::format("P6\n{} {}\n255\n", width, height);
+                std::fwrite(header.data(), 1, header.size(), file);
+                toRgb(rgba);
+                bool ok = std::fwrite(packed.data(), 1, packed.size(), file) == packed.size();
+                ok = std::fclose(file) == 0 && ok;
+                return ok ? std::string() : "Could not write " + path;
+            }
+            case FrameFormat::Raw: {
+                toRgb(rgba);
+                return std::fwrite(packed.data(), 1, packed.size(), stdout) == packed.size()
+                    ? std::string() : "Could not write frame to stdout";
+            }
+            case FrameFormat::Y4m: {
+                // BT.601 limited range, planar Y, U, V
+                packed.resize(pixels * 3);
+                uint8_t* y = packed.data();
+                uint8_t* u = y + pixels;
+                uint8_t* v = u + pixels;
+                for (size_t i = 0; i < pixels; ++i) {
+                    int r = rgba[i * 4 + 0], g = rgba[i * 4 + 1], b = rgba[i * 4 + 2];
+                    y[i] = static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+                    u[i] = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                    v[i] = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+                }
+                static const char tag[] = "FRAME\n";
+                bool ok = std::fwrite(tag, 1, sizeof(tag) - 1, stdout) == sizeof(tag) - 1;
+                ok = std::fwrite(packed.data(), 1, packed.size(), stdout) == packed.size() && ok;
+                return ok ? std::string() : "Could not write frame to stdout";
+            }
+        }
+        return "Unknown frame format";
+    }
+    
+    // Drop alpha into the writer-owned scratch buffer
+    void toRgb(const std::vector<uint8_t>& rgba) {
+        const size_t pixels = size_t(width) * height;
+        packed.resize(pixels * 3);
+        for (size_t i = 0; i < pixels; ++i) {
+            packed[i * 3 + 0] = rgba[i * 4 + 0];
+            packed[i * 3 + 1] = rgba[i * 4 + 1];
+            packed[i * 3 + 2] = rgba[i * 4 + 2];
+        }
+    }
+    
+    FrameFormat format;
+    int width;
+    int height;
+    std::string pattern;
+    
+    std::vector<std::vector<uint8_t>> buffers;
+    std::vector<int> freeBuffers;
+    std::deque<Job> queue;
+    std::vector<uint8_t> packed;  // Writer thread only
+    int nextFrame = 0;
+    bool writing = false;
+    bool stopping = false;
+    std::string error;
+    WriterStats stats;
+    
+    mutable std::mutex mutex;
+    std::condition_variable queueReady;
+    std::condition_variable bufferFree;
+    std::thread writer;
+};
+
+// Where a pipelined sequence spent its time
+struct PipelineStats {
+    int frames = 0;
+    int framesInFlight = 0;
+    double renderSeconds = 0.0;  // Summed over slots; above wall time when frames overlap
+    double orderSeconds = 0.0;   // Slots waiting for earlier frames before submitting
+    double wallSeconds = 0.0;
+    
+    // Average number of frames being rendered at once
+    double overlap() const { return wallSeconds > 0.0 ? renderSeconds / wallSeconds : 0.0; }
+};
+
+// Renders a sequence with several frames in flight. Each slot is a thread
+// with its own renderer, scene and camera (set up by the caller), so frame
+// N+1 starts marching while frame N is still in its serial stages (ray
+// table, denoise, tonemap) and the cores stay busy. Frames reach the writer
+// in order; a slot holds its finished frame until the previous one is in.
+class FramePipeline {
+public:
+    using Publish = std::function<void(const uint8_t* rgba)>;
+    
+    FramePipeline(FrameWriter& writer, int framesInFlight)
+        : writer(writer), slots(std::max(framesInFlight, 1)) {}
+    
+    // Also hand every frame to publish, in order, right after it is queued
+    // for writing; e.g. to copy it into a SharedFrameRing. Slots render out
+    // of order, so per-renderer exports would not see the sequence in order.
+    void setPublisher(Publish callback) { publish = std::move(callback); }
+    
+    // render(slot, frame) renders one frame with the slot's own state and
+    // returns its RGBA8 pixels, which must stay valid until the slot's next
+    // call. Rethrows the first exception from a render or the writer.
+    template <typename Render>
+    PipelineStats run(int frameCount, Render&& render) {
+        stats = PipelineStats();
+        stats.framesInFlight = slots;
+        nextFrame = 0;
+        nextSubmit = 0;
+        failure = nullptr;
+        
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (int slot = 0; slot < slots; ++slot) {
+            threads.emplace_back([&, slot] {
+                try {
+                    slotLoop(slot, frameCount, render);
+                } catch (...) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (!failure) {
+                        failure = std::current_exception();
+                    }
+                    turn.notify_all();
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        stats.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+        return stats;
+    }
+
+private:
+    template <typename Render>
+    void slotLoop(int slot, int frameCount, Render& render) {
+        while (true) {
+            int frame;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (failure || nextFrame >= frameCount) {
+                    return;
+                }
+                frame = nextFrame++;
+            }
+            
+            auto start = std::chrono::steady_clock::now();
+            const uint8_t* pixels = render(slot, frame);
+            auto rendered = std::chrono::steady_clock::now();
+            
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                turn.wait(lock, [&] { return nextSubmit == frame || failure; });
+                if (failure) {
+                    return;
+                }
+            }
+            auto ready = std::chrono::steady_clock::now();
+            
+            // Only the slot holding frame nextSubmit gets here. submit() copies
+            // the pixels, so the slot can render again right after.
+            writer.submit(pixels);
+            if (publish) {
+                publish(pixels);
+            }
+            
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stats.renderSeconds += std::chrono::duration<double>(rendered - start).count();
+                stats.orderSeconds += std::chrono::duration<double>(ready - rendered).count();
+                stats.frames++;
+                nextSubmit++;
+            }
+            turn.notify_all();
+        }
+    }
+    
+    FrameWriter& writer;
+    Publish publish;
+    int slots;
+    int nextFrame = 0;
+    int nextSubmit = 0;
+    std::exception_ptr failure;
+    PipelineStats stats;
+    std::mutex mutex;
+    std::condition_variable turn;
+};
+
+} // namespace rm
@@ -0,0 +1,138 @@
+// Follows a renderer started with --share-frames NAME through its shared
+// frame ring: reports frame rate, publish-to-read latency, dropped and torn
+// frames, and can dump the newest frame as a PPM.
+//   raymarch_framereader NAME [--seconds S] [--dump frame.ppm]
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+import framering;
+
+using namespace rm;
+
+namespace {
+
+bool writePpm(const std::string& path, const std::vector<uint8_t>& rgba, int width, int height) {
+    std::FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+    std::string header = std::format("P6\n{} {}\n255\n", width, height);
+    std::fwrite(header.data(), 1, header.size(), file);
+    std::vector<uint8_t> rgb(size_t(width) * height * 3);
+    for (size_t i = 0; i < rgb.size() / 3; ++i) {
+        rgb[i * 3 + 0] = rgba[i * 4 + 0];
+        rgb[i * 3 + 1] = rgba[i * 4 + 1];
+        rgb[i * 3 + 2] = rgba[i * 4 + 2];
+    }
+    bool ok = std::fwrite(rgb.data(), 1, rgb.size(), file) == rgb.size();
+    return std::fclose(file) == 0 && ok;
+}
+
+// Whole-argument positive number; anything else is a usage error
+bool parsePositive(const char* text, double& value) {
+    const char* end = text + std::strlen(text);
+    double parsed = 0.0;
+    auto [ptr, error] = std::from_chars(text, end, parsed);
+    if (error != std::errc() || ptr != end || !(parsed > 0.0) || !std::isfinite(parsed)) {
+        return false;
+    }
+    value = parsed;
+    return true;
+}
+
+uint64_t nowNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string name;
+    std::string dumpPath;
+    double seconds = 5.0;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--seconds") == 0 && i + 1 < argc && parsePositive(argv[i + 1], seconds)) {
+            ++i;
+        } else if (std::strcmp(argv[i], "--dump") == 0 && i + 1 < argc) {
+            dumpPath = argv[++i];
+        } else if (name.empty() && argv[i][0] != '-') {
+            name = argv[i];
+        } else {
+            name.clear();
+            break;
+        }
+    }
+    if (name.empty()) {
+        std::cerr << "usage: raymarch_framereader NAME [--seconds S] [--dump frame.ppm]\n";
+        return 1;
+    }
+
+    if (name[0] != '/') {
+        name = "/" + name;
+    }
+
+    try {
+        SharedFrameReader reader(name);
+        std::cout << std::format("{}: {}x{}, {} slots\n", name, reader.getWidth(), reader.getHeight(),
+                                 reader.getSlotCount());
+
+        // Poll the publish counter; reading a frame touches only mapped memory
+        std::vector<uint8_t> pixels;
+        SharedFrameInfo info;
+        uint64_t lastFrame = reader.getPublished();
+        int frames = 0;
+        int dropped = 0;
+        int torn = 0;
+        double latencyMs = 0.0;
+        const uint64_t start = nowNs();
+        while ((nowNs() - start) * 1e-9 < seconds) {
+            if (reader.getPublished() == lastFrame) {
+                std::this_thread::sleep_for(std::chrono::microseconds(200));
+                continue;
+            }
+            if (!reader.copyLatest(pixels, info)) {
+                torn++;
+                continue;
+            }
+            if (info.frame <= lastFrame) {
+                continue;
+            }
+            dropped += static_cast<int>(info.frame - lastFrame - 1);
+            lastFrame = info.frame;
+            frames++;
+            latencyMs += (nowNs() - info.timestampNs) * 1e-6;
+        }
+
+        const double elapsed = (nowNs() - start) * 1e-9;
+        std::cout << std::format("Read {} frames in {:.2f}s ({:.1f} fps), {} skipped, {} torn reads retried\n",
+                                 frames, elapsed, frames / elapsed, dropped, torn);
+        if (frames > 0) {
+            std::cout << std::format("  Mean publish-to-copy latency: {:.3f}ms (last frame {})\n",
+                                     latencyMs / frames, info.frame);
+        }
+        if (!dumpPath.empty()) {
+            if (frames == 0 && !reader.copyLatest(pixels, info)) {
+                std::cerr << "No frame to dump\n";
+                return 1;
+            }
+            if (!writePpm(dumpPath, pixels, reader.getWidth(), reader.getHeight())) {
+                std::cerr << "Could not write " << dumpPath << "\n";
+                return 1;
+            }
+            std::cout << std::format("Wrote frame {} to {}\n", info.frame, dumpPath);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}